@@ -2,31 +2,45 @@
 /// 2SF2ROM: 2SF to NDS ROM Converter.
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <string.h>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
 #include <stdexcept>
 
 #ifdef _WIN32
-#include <Windows.h>
-#include <direct.h>
-#define PATH_MAX MAX_PATH
-#define getcwd _getcwd
-#define chdir _chdir
-#else
-#include <unistd.h>
+#include <fcntl.h>
+#include <io.h>
 #endif
 
-#include <zlib.h>
-
-#include "byteio.hpp"
-#include "psf_file.hpp"
-#include "ZlibReader.h"
+#include "async_loader.hpp"
+#include "batch_converter.hpp"
+#include "benchmark.hpp"
+#include "flattener.hpp"
+#include "lazy_rom_image.hpp"
+#include "mini_optimizer.hpp"
+#include "parallel.hpp"
+#include "psf_carver.hpp"
+#include "psf_dedup.hpp"
+#include "psf_verifier.hpp"
+#include "rom_pack.hpp"
+#include "rom_server.hpp"
+#include "rom_writer.hpp"
+#include "tar_converter.hpp"
 #include "cpath.h"
 
 namespace {
@@ -46,130 +60,20 @@ constexpr auto kApplicationWebsite = "https://github.com/loveemu/2sf2rom";
 /// The version byte of 2SF file.
 constexpr uint8_t k2SFVersionByte = 0x24;
 
-/// The maximum ROM size of NDS.
-constexpr size_t kNDSRomMaxSize = 128 * 1024 * 1024;
-
-/// The maximum nest level of psflib.
-constexpr int kPSFLibMaxNestLevel = 10;
-
-} // namespace
-
-/// Load ROM image from 2SF file.
-/// @param filename the path to 2sf file.
-/// @param rom the rom image to be loaded.
-/// @param lib_nest_level the nest level of psflib.
-/// @param first_load true for the first file.
-void load_2sf(const std::string & filename, std::vector<char> & rom, int lib_nest_level = 0, bool first_load = true) {
-  // check the psflib nest level
-  if (lib_nest_level >= kPSFLibMaxNestLevel) {
-    std::ostringstream message_buffer;
-    message_buffer << filename << ": " << "Nest level error on psflib loading.";
-    throw std::out_of_range(message_buffer.str());
-  }
-
-  // save the current directory
-  char pwd[PATH_MAX];
-  getcwd(pwd, PATH_MAX);
-
-  // get the absolute path
-  char absolute_path[PATH_MAX];
-  if (path_getabspath(filename.c_str(), absolute_path) == NULL) {
-    std::ostringstream message_buffer;
-    message_buffer << filename << ": " << "Unable to determine absolute path.";
-    throw std::out_of_range(message_buffer.str());
-  }
-
-  // get the directory path
-  char basedir[PATH_MAX];
-  strcpy(basedir, absolute_path);
-  path_dirname(basedir);
-
-  // load the psf file
-  PSFFile psf(filename);
-
-  // check CRC32 of the compressed program
-  uint32_t actual_crc32 = ::crc32(0L, reinterpret_cast<const Bytef *>(
-    psf.compressed_exe().data()), static_cast<uInt>(psf.compressed_exe().size()));
-  if (psf.compressed_exe_crc32() != actual_crc32) {
-    std::ostringstream message_buffer;
-    message_buffer << filename << ": " << "CRC32 error at the compressed program.";
-    throw std::runtime_error(message_buffer.str());
-  }
-
-  // load psflibs
-  int lib_index = 1;
-  while (true) {
-    // search for _libN tag
-    std::ostringstream lib_tag_name_buffer;
-    lib_tag_name_buffer << "_lib";
-    if (lib_index > 1) {
-      lib_tag_name_buffer << lib_index;
-    }
-    std::string lib_tag_name = lib_tag_name_buffer.str();
-
-    // if no tag is present, end the lib loading
-    if (psf.tags().count(lib_tag_name) == 0) {
-      break;
-    }
-
-    // set the current directory to the parent psf directory
-    chdir(basedir);
-
-    // load the lib
-    try {
-      load_2sf(psf.tags()[lib_tag_name], rom, lib_nest_level + 1, first_load);
-    }
-    catch (std::exception) {
-      chdir(pwd);
-      throw;
-    }
-    chdir(pwd);
-    first_load = false;
-
-    // check the next lib
-    lib_index++;
-  }
-
-  // read the exe header
-  // - 4 bytes offset
-  // - 4 bytes size
-  ZlibReader compressed_exe(psf.compressed_exe().c_str(), psf.compressed_exe().size());
-  uint32_t load_offset;
-  uint32_t load_size;
-  bool read_success = true;
-  read_success &= compressed_exe.readInt(load_offset);
-  read_success &= compressed_exe.readInt(load_size);
-  if (!read_success) {
-    std::ostringstream message_buffer;
-    message_buffer << filename << ": " << "Unable to read the program header.";
-    throw std::runtime_error(message_buffer.str());
-  }
+/// The interval of progress updates of the --progress option.
+constexpr auto kProgressInterval = std::chrono::milliseconds(100);
 
-  // ensure the rom buffer size
-  if (load_offset + load_size > kNDSRomMaxSize) {
-    std::ostringstream message_buffer;
-    message_buffer << filename << ": " << "Load offset/size of 2SF is too large. ";
-    throw std::out_of_range(message_buffer.str());
-  }
-  if (first_load) {
-    rom.resize(load_offset + load_size, 0);
-  }
-  else {
-    if (load_offset + load_size > rom.size()) {
-      std::ostringstream message_buffer;
-      message_buffer << filename << ": " << "Load offset/size of 2SF is out of bound.";
-      throw std::out_of_range(message_buffer.str());
-    }
-  }
+/// True once SIGINT has been received during --progress.
+volatile std::sig_atomic_t g_interrupted = 0;
 
-  // decompress the program area
-  if (compressed_exe.read(&rom[load_offset], load_size) != load_size) {
-    std::ostringstream message_buffer;
-    message_buffer << filename << ": " << "Failed to deflate data. Program data is corrupted.";
-    throw std::out_of_range(message_buffer.str());
-  }
+/// Records SIGINT, so that the pending loads are cancelled.
+/// @param signal the number of the signal.
+extern "C" void handle_interrupt(int) {
+  g_interrupted = 1;
 }
 
+} // namespace
+
 /// Show usage of 2SF2ROM.
 /// @param cmd the name of commmand.
 void show_usage(std::string cmd) {
@@ -185,7 +89,7 @@ void show_usage(std::string cmd) {
   std::cout << "-----" << std::endl;
   std::cout << std::endl;
 
-  std::cout << "`" << cmd << " [options] 2sf-file`" << std::endl;
+  std::cout << "`" << cmd << " [options] 2sf-files`" << std::endl;
   std::cout << std::endl;
 
   std::cout << "### Options" << std::endl;
@@ -195,31 +99,182 @@ void show_usage(std::string cmd) {
   std::cout << "  : Show this help." << std::endl;
   std::cout << std::endl;
   std::cout << "`-o filename`" << std::endl;
-  std::cout << "  : Set the output filename." << std::endl;
+  std::cout << "  : Set the output filename (single input only)." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`--gzip`" << std::endl;
+  std::cout << "  : Write the ROM as independent gzip members of 1 MiB, compressed in parallel," << std::endl;
+  std::cout << "    with an index of member offsets (filename.gzi)." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`--parallel-write`" << std::endl;
+  std::cout << "  : Preallocate the ROM file, and write it in 4 MiB segments on multiple threads," << std::endl;
+  std::cout << "    skipping the segments filled with zero." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`--direct-io`" << std::endl;
+  std::cout << "  : Write the ROM with O_DIRECT, and drop the input files (not psflibs) from the" << std::endl;
+  std::cout << "    page cache once converted." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`--cache-size MiB`" << std::endl;
+  std::cout << "  : Set the capacity of the decompressed psflib cache (default: 256, 0 to disable)." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`--cache-dedup`" << std::endl;
+  std::cout << "  : Share identical 4 KiB pages among the cached psflibs." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`--cache-compress`" << std::endl;
+  std::cout << "  : Keep the cached psflibs compressed in 64 KiB blocks." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`--stats`" << std::endl;
+  std::cout << "  : Show the metrics of the psflib cache and the concurrency." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`-j threads`" << std::endl;
+  std::cout << "  : Convert with the number of threads (default: 1), or `auto` to adjust it to" << std::endl;
+  std::cout << "    the measured throughput." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`--progress`" << std::endl;
+  std::cout << "  : Show the progress of each file, loading the files asynchronously without the" << std::endl;
+  std::cout << "    psflib cache. Ctrl-C cancels the loads in progress." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`--numa`" << std::endl;
+  std::cout << "  : Bind the threads to NUMA nodes, with a psflib cache for each node." << std::endl;
+  std::cout << std::endl;
+  std::cout << "When multiple files are given, the psflibs shared among them are composed only once." << std::endl;
+  std::cout << std::endl;
+
+  std::cout << "### Commands" << std::endl;
+  std::cout << std::endl;
+
+  std::cout << "`" << cmd << " pack -o pack-file 2sf-files`" << std::endl;
+  std::cout << "  : Convert the files into a single ROM pack." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`" << cmd << " unpack [--list] [-o filename] pack-file [names]`" << std::endl;
+  std::cout << "  : Extract the named ROMs (all ROMs by default) from a ROM pack." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`" << cmd << " dedup [--hardlink|--reflink] [--rewrite-libs] psf-files`" << std::endl;
+  std::cout << "  : Find the files having identical programs, replace identical files with links," << std::endl;
+  std::cout << "    and rewrite _lib tags to point at the first (canonical) copy." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`" << cmd << " optimize [--split] mini2sf-files`" << std::endl;
+  std::cout << "  : Shrink the programs of the files to the bytes which differ from their psflibs." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`" << cmd << " flatten [-o filename] [-j threads] 2sf-files`" << std::endl;
+  std::cout << "  : Compose each file with its psflibs into a single 2SF file without _lib tags" << std::endl;
+  std::cout << "    (filename.2sf by default)." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`" << cmd << " bench [--warmup N] [--repeat N] [--scratch dir] directories`" << std::endl;
+  std::cout << "  : Measure the conversion of the 2SF files in the directories over the numbers of" << std::endl;
+  std::cout << "    threads, the psflib cache and the output formats." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`" << cmd << " tar [-d directory] [--gzip] [--cache-size MiB] tar-file`" << std::endl;
+  std::cout << "  : Convert the 2SF files in a tar archive (- for the standard input) without" << std::endl;
+  std::cout << "    extracting it, into the directory (the current directory by default)." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`" << cmd << " verify [--stamp] psf-files`" << std::endl;
+  std::cout << "  : Verify the CRC32 and the zlib stream of the files. --stamp records the result" << std::endl;
+  std::cout << "    in an extended attribute, and skips the files unchanged since then (Linux only)." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`" << cmd << " carve [-d directory] [-j threads] files`" << std::endl;
+  std::cout << "  : Extract the 2SF files embedded in large binaries (disk images, archives) into" << std::endl;
+  std::cout << "    the directory (the current directory by default)." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`" << cmd << " peek [-o filename] 2sf-file offset size`" << std::endl;
+  std::cout << "  : Show (or write) a range of the ROM, decompressing only the pages it covers" << std::endl;
+  std::cout << "    where userfaultfd is available." << std::endl;
+  std::cout << std::endl;
+  std::cout << "`" << cmd << " serve [--mode octal] [--max-connections N] socket-path`" << std::endl;
+  std::cout << "  : Serve the ROMs of 2SF files as sealed memory files over a UNIX socket (Linux only)." << std::endl;
+  std::cout << "    The socket is accessible by the owner only (mode 600) by default." << std::endl;
   std::cout << std::endl;
 }
 
-/// Main of 2SF2ROM.
+/// Returns the default output filename for a 2SF file.
+/// @param filename the path to 2sf file.
+/// @return the path to the output ROM file.
+std::string get_rom_filename(const std::string & filename) {
+  const char * filename_c = filename.c_str();
+  off_t ext = path_findext(filename_c) - filename_c;
+  return filename.substr(0, ext) + ".data.bin";
+}
+
+/// Main of the pack command.
 /// @param argc the number of command-line arguments.
-/// @param argv the command-line arguments.
+/// @param argv the command-line arguments, starting with the command name.
 /// @return the exit status.
-int main(int argc, char * argv[]) {
+int pack_main(int argc, char * argv[]) {
   try {
-    std::string output_filename;
+    std::string pack_filename;
 
-    // show usage if arg is empty
-    if (argc <= 1) {
-      show_usage(argv[0]);
+    // parse options
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-') {
+      std::string arg(argv[argi]);
+      if (arg == "-o") {
+        if (argi + 1 >= argc) {
+          std::ostringstream message_buffer;
+          message_buffer << "Too few arguments for \"" << arg << "\"";
+          throw std::invalid_argument(message_buffer.str());
+        }
+
+        pack_filename = argv[argi + 1];
+        argi++;
+      }
+      else {
+        std::ostringstream message_buffer;
+        message_buffer << "Unknown option \"" << arg << "\"";
+        throw std::invalid_argument(message_buffer.str());
+      }
+
+      argi++;
+    }
+
+    if (pack_filename.empty()) {
+      throw std::invalid_argument("No output pack file.");
+    }
+
+    if (argi == argc) {
+      throw std::invalid_argument("No input files.");
+    }
+
+    // each ROM is named after its default output filename without the
+    // directories, which is where unpack writes it
+    RomPackWriter writer;
+    std::set<std::string> names;
+    for (; argi < argc; argi++) {
+      std::string filename(argv[argi]);
+      std::string rom_filename = get_rom_filename(filename);
+      std::string name = path_findbase(rom_filename.c_str());
+      if (!names.insert(name).second) {
+        std::ostringstream message_buffer;
+        message_buffer << filename << ": " << "Another file has the ROM name \"" << name << "\".";
+        throw std::invalid_argument(message_buffer.str());
+      }
+      writer.add(filename, name);
+    }
+
+    if (writer.write(pack_filename) != 0) {
       return 1;
     }
+  }
+  catch (const std::exception & ex) {
+    std::cout << "Error: " << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/// Main of the unpack command.
+/// @param argc the number of command-line arguments.
+/// @param argv the command-line arguments, starting with the command name.
+/// @return the exit status.
+int unpack_main(int argc, char * argv[]) {
+  try {
+    std::string output_filename;
+    bool list_only = false;
 
     // parse options
     int argi = 1;
     while (argi < argc && argv[argi][0] == '-') {
       std::string arg(argv[argi]);
-      if (arg == "--help") {
-        show_usage(argv[0]);
-        return 1;
+      if (arg == "--list") {
+        list_only = true;
       }
       else if (arg == "-o") {
         if (argi + 1 >= argc) {
@@ -244,29 +299,960 @@ int main(int argc, char * argv[]) {
       throw std::invalid_argument("No input files.");
     }
 
-    if (argi + 1 > argc) {
+    RomPackReader reader(argv[argi]);
+    argi++;
+
+    // determine the ROMs to be extracted
+    std::vector<size_t> indices;
+    if (argi == argc) {
+      for (size_t index = 0; index < reader.size(); index++) {
+        indices.push_back(index);
+      }
+    }
+    for (; argi < argc; argi++) {
+      size_t index = reader.find(argv[argi]);
+      if (index == RomPackReader::npos) {
+        std::ostringstream message_buffer;
+        message_buffer << argv[argi] << ": " << "No such ROM in the pack.";
+        throw std::invalid_argument(message_buffer.str());
+      }
+      indices.push_back(index);
+    }
+
+    if (!output_filename.empty() && indices.size() != 1) {
       throw std::invalid_argument("Too many arguments.");
     }
 
-    // determine filenames
-    std::string filename(argv[argi]);
-    if (output_filename.empty()) {
-      const char * filename_c = filename.c_str();
-      off_t ext = path_findext(filename_c) - filename_c;
-      output_filename = filename.substr(0, ext) + ".data.bin";
+    if (list_only) {
+      for (size_t index : indices) {
+        std::cout << reader.name(index) << std::endl;
+      }
+      return 0;
+    }
+
+    // the names come from the pack, so never write outside the current
+    // directory, and never let two ROMs overwrite the same file
+    std::vector<std::string> rom_filenames;
+    std::map<std::string, std::string> rom_names;
+    for (size_t index : indices) {
+      std::string rom_filename = output_filename;
+      if (rom_filename.empty()) {
+        std::string name = reader.name(index);
+        rom_filename = path_findbase(name.c_str());
+        if (rom_filename.empty() || rom_filename == "." || rom_filename == "..") {
+          std::ostringstream message_buffer;
+          message_buffer << name << ": " << "Invalid ROM name in the pack.";
+          throw std::runtime_error(message_buffer.str());
+        }
+
+        auto inserted = rom_names.insert(std::make_pair(rom_filename, name));
+        if (!inserted.second) {
+          std::ostringstream message_buffer;
+          message_buffer << name << ": " << "The output file \"" << rom_filename << "\" is also written by \"" <<
+            inserted.first->second << "\". Extract them one by one with -o.";
+          throw std::runtime_error(message_buffer.str());
+        }
+      }
+      rom_filenames.push_back(rom_filename);
     }
 
-    // load rom image
     std::vector<char> rom;
-    load_2sf(filename, rom);
+    for (size_t i = 0; i < indices.size(); i++) {
+      rom.resize(reader.rom_size(indices[i]));
+      reader.extract(indices[i], rom.data());
+      write_rom(rom_filenames[i], rom.data(), rom.size());
+    }
+  }
+  catch (const std::exception & ex) {
+    std::cout << "Error: " << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/// Main of the dedup command.
+/// @param argc the number of command-line arguments.
+/// @param argv the command-line arguments, starting with the command name.
+/// @return the exit status.
+int dedup_main(int argc, char * argv[]) {
+  try {
+    DedupOptions options;
+
+    // parse options
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-') {
+      std::string arg(argv[argi]);
+      if (arg == "--hardlink") {
+        options.link_mode = DedupLinkMode::kHardlink;
+      }
+      else if (arg == "--reflink") {
+        options.link_mode = DedupLinkMode::kReflink;
+      }
+      else if (arg == "--rewrite-libs") {
+        options.rewrite_libs = true;
+      }
+      else {
+        std::ostringstream message_buffer;
+        message_buffer << "Unknown option \"" << arg << "\"";
+        throw std::invalid_argument(message_buffer.str());
+      }
+
+      argi++;
+    }
+
+    if (argi == argc) {
+      throw std::invalid_argument("No input files.");
+    }
+
+    PSFDeduplicator deduplicator(options);
+    for (; argi < argc; argi++) {
+      deduplicator.add(argv[argi]);
+    }
+
+    if (deduplicator.run() != 0) {
+      return 1;
+    }
+  }
+  catch (const std::exception & ex) {
+    std::cout << "Error: " << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/// Main of the optimize command.
+/// @param argc the number of command-line arguments.
+/// @param argv the command-line arguments, starting with the command name.
+/// @return the exit status.
+int optimize_main(int argc, char * argv[]) {
+  try {
+    MiniOptimizerOptions options;
+
+    // parse options
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-') {
+      std::string arg(argv[argi]);
+      if (arg == "--split") {
+        options.split = true;
+      }
+      else {
+        std::ostringstream message_buffer;
+        message_buffer << "Unknown option \"" << arg << "\"";
+        throw std::invalid_argument(message_buffer.str());
+      }
+
+      argi++;
+    }
+
+    if (argi == argc) {
+      throw std::invalid_argument("No input files.");
+    }
+
+    MiniOptimizer optimizer(options);
+    for (; argi < argc; argi++) {
+      optimizer.add(argv[argi]);
+    }
+
+    if (optimizer.run() != 0) {
+      return 1;
+    }
+  }
+  catch (const std::exception & ex) {
+    std::cout << "Error: " << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/// Main of the flatten command.
+/// @param argc the number of command-line arguments.
+/// @param argv the command-line arguments, starting with the command name.
+/// @return the exit status.
+int flatten_main(int argc, char * argv[]) {
+  try {
+    std::string output_filename;
+    unsigned int thread_count = 0;
+
+    // parse options
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-') {
+      std::string arg(argv[argi]);
+      if (arg == "-o" || arg == "-j") {
+        if (argi + 1 >= argc) {
+          std::ostringstream message_buffer;
+          message_buffer << "Too few arguments for \"" << arg << "\"";
+          throw std::invalid_argument(message_buffer.str());
+        }
+
+        if (arg == "-o") {
+          output_filename = argv[argi + 1];
+        }
+        else {
+          thread_count = static_cast<unsigned int>(std::stoul(argv[argi + 1]));
+        }
+        argi++;
+      }
+      else {
+        std::ostringstream message_buffer;
+        message_buffer << "Unknown option \"" << arg << "\"";
+        throw std::invalid_argument(message_buffer.str());
+      }
+
+      argi++;
+    }
+
+    if (argi == argc) {
+      throw std::invalid_argument("No input files.");
+    }
+
+    if (!output_filename.empty() && argi + 1 < argc) {
+      throw std::invalid_argument("Too many arguments.");
+    }
+
+    int failures = 0;
+    for (; argi < argc; argi++) {
+      std::string filename(argv[argi]);
+      std::string flat_filename(output_filename);
+      if (flat_filename.empty()) {
+        const char * filename_c = filename.c_str();
+        off_t ext = path_findext(filename_c) - filename_c;
+        flat_filename = filename.substr(0, ext) + ".2sf";
+      }
+
+      try {
+        flatten_2sf(filename, flat_filename, thread_count);
+      }
+      catch (const std::exception & ex) {
+        std::cout << "Error: " << ex.what() << std::endl;
+        failures++;
+      }
+    }
+
+    if (failures != 0) {
+      return 1;
+    }
+  }
+  catch (const std::exception & ex) {
+    std::cout << "Error: " << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
 
-    // write decompressed rom to file
-    std::ofstream out;
-    out.exceptions(std::ios::badbit | std::ios::failbit);
-    out.open(output_filename, std::ios::binary);
-    out.write(rom.data(), rom.size());
+/// Main of the bench command.
+/// @param argc the number of command-line arguments.
+/// @param argv the command-line arguments, starting with the command name.
+/// @return the exit status.
+int bench_main(int argc, char * argv[]) {
+  try {
+    BenchmarkOptions options;
+
+    // parse options
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-') {
+      std::string arg(argv[argi]);
+      if (arg == "--warmup" || arg == "--repeat" || arg == "--scratch") {
+        if (argi + 1 >= argc) {
+          std::ostringstream message_buffer;
+          message_buffer << "Too few arguments for \"" << arg << "\"";
+          throw std::invalid_argument(message_buffer.str());
+        }
+
+        if (arg == "--warmup") {
+          options.warmup = static_cast<unsigned int>(std::stoul(argv[argi + 1]));
+        }
+        else if (arg == "--repeat") {
+          options.repeat = static_cast<unsigned int>(std::stoul(argv[argi + 1]));
+          if (options.repeat == 0) {
+            throw std::invalid_argument("The number of runs must be positive.");
+          }
+        }
+        else {
+          options.scratch_directory = argv[argi + 1];
+        }
+        argi++;
+      }
+      else {
+        std::ostringstream message_buffer;
+        message_buffer << "Unknown option \"" << arg << "\"";
+        throw std::invalid_argument(message_buffer.str());
+      }
+
+      argi++;
+    }
+
+    if (argi == argc) {
+      throw std::invalid_argument("No input directories.");
+    }
+
+    Benchmark benchmark(options);
+    size_t file_count = 0;
+    for (; argi < argc; argi++) {
+      file_count += benchmark.add_directory(argv[argi]);
+    }
+    if (file_count == 0) {
+      throw std::invalid_argument("No 2SF files found.");
+    }
+
+    std::vector<BenchmarkResult> results = benchmark.run();
+    std::cout << std::endl;
+    benchmark.print(results);
+  }
+  catch (const std::exception & ex) {
+    std::cout << "Error: " << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/// Main of the tar command.
+/// @param argc the number of command-line arguments.
+/// @param argv the command-line arguments, starting with the command name.
+/// @return the exit status.
+int tar_main(int argc, char * argv[]) {
+  try {
+    std::string output_directory;
+    RomOutputMode output_mode = RomOutputMode::kRaw;
+    size_t cache_capacity = kLibCacheDefaultCapacity;
+
+    // parse options ("-" alone is the standard input)
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0') {
+      std::string arg(argv[argi]);
+      if (arg == "--gzip") {
+        output_mode = RomOutputMode::kChunkedGzip;
+      }
+      else if (arg == "-d" || arg == "--cache-size") {
+        if (argi + 1 >= argc) {
+          std::ostringstream message_buffer;
+          message_buffer << "Too few arguments for \"" << arg << "\"";
+          throw std::invalid_argument(message_buffer.str());
+        }
+
+        if (arg == "-d") {
+          output_directory = argv[argi + 1];
+        }
+        else {
+          cache_capacity = std::stoul(argv[argi + 1]) * 1024 * 1024;
+        }
+        argi++;
+      }
+      else {
+        std::ostringstream message_buffer;
+        message_buffer << "Unknown option \"" << arg << "\"";
+        throw std::invalid_argument(message_buffer.str());
+      }
+
+      argi++;
+    }
+
+    if (argi == argc) {
+      throw std::invalid_argument("No input files.");
+    }
+
+    if (argi + 1 < argc) {
+      throw std::invalid_argument("Too many arguments.");
+    }
+
+    TarConverter converter(output_directory, output_mode, cache_capacity);
+    std::string filename(argv[argi]);
+    int failures;
+    if (filename == "-") {
+#ifdef _WIN32
+      _setmode(_fileno(stdin), _O_BINARY);
+#endif
+      failures = converter.run(std::cin, "(stdin)");
+    }
+    else {
+      std::ifstream in(filename, std::ios::binary);
+      if (!in) {
+        std::ostringstream message_buffer;
+        message_buffer << filename << ": " << "File not exists.";
+        throw std::runtime_error(message_buffer.str());
+      }
+      failures = converter.run(in, filename);
+    }
+
+    if (failures != 0) {
+      return 1;
+    }
+  }
+  catch (const std::exception & ex) {
+    std::cout << "Error: " << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/// Main of the verify command.
+/// @param argc the number of command-line arguments.
+/// @param argv the command-line arguments, starting with the command name.
+/// @return the exit status.
+int verify_main(int argc, char * argv[]) {
+  try {
+    bool use_stamps = false;
+
+    // parse options
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-') {
+      std::string arg(argv[argi]);
+      if (arg == "--stamp") {
+        use_stamps = true;
+      }
+      else {
+        std::ostringstream message_buffer;
+        message_buffer << "Unknown option \"" << arg << "\"";
+        throw std::invalid_argument(message_buffer.str());
+      }
+
+      argi++;
+    }
+
+    if (argi == argc) {
+      throw std::invalid_argument("No input files.");
+    }
+
+    PSFVerifier verifier(kApplicationVersion, use_stamps);
+    int verified = 0;
+    int stamped = 0;
+    int failures = 0;
+    for (; argi < argc; argi++) {
+      try {
+        if (verifier.verify(argv[argi]) == PSFVerifierResult::kStamped) {
+          stamped++;
+        }
+        else {
+          verified++;
+        }
+      }
+      catch (const std::exception & ex) {
+        std::cout << "Error: " << ex.what() << std::endl;
+        failures++;
+      }
+    }
+
+    std::cout << verified << " files verified, " << stamped << " unchanged since the last verification, "
+      << failures << " failed." << std::endl;
+    if (failures != 0) {
+      return 1;
+    }
+  }
+  catch (const std::exception & ex) {
+    std::cout << "Error: " << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/// Main of the carve command.
+/// @param argc the number of command-line arguments.
+/// @param argv the command-line arguments, starting with the command name.
+/// @return the exit status.
+int carve_main(int argc, char * argv[]) {
+  try {
+    std::string output_directory;
+    unsigned int thread_count = 0;
+
+    // parse options
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-') {
+      std::string arg(argv[argi]);
+      if (arg == "-d" || arg == "-j") {
+        if (argi + 1 >= argc) {
+          std::ostringstream message_buffer;
+          message_buffer << "Too few arguments for \"" << arg << "\"";
+          throw std::invalid_argument(message_buffer.str());
+        }
+
+        if (arg == "-d") {
+          output_directory = argv[argi + 1];
+        }
+        else {
+          thread_count = static_cast<unsigned int>(std::stoul(argv[argi + 1]));
+        }
+        argi++;
+      }
+      else {
+        std::ostringstream message_buffer;
+        message_buffer << "Unknown option \"" << arg << "\"";
+        throw std::invalid_argument(message_buffer.str());
+      }
+
+      argi++;
+    }
+
+    if (argi == argc) {
+      throw std::invalid_argument("No input files.");
+    }
+
+    size_t carved = 0;
+    int failures = 0;
+    for (; argi < argc; argi++) {
+      try {
+        std::string filename(argv[argi]);
+        std::vector<CarvedPSF> files = carve_2sf_file(filename, output_directory, thread_count);
+        for (const CarvedPSF & psf : files) {
+          std::cout << filename << ": " << psf.offset << ": " << psf.size << " bytes -> "
+            << get_carved_filename(filename, output_directory, psf) << std::endl;
+        }
+        carved += files.size();
+      }
+      catch (const std::exception & ex) {
+        std::cout << "Error: " << ex.what() << std::endl;
+        failures++;
+      }
+    }
+
+    std::cout << carved << " PSF files carved." << std::endl;
+    if (failures != 0) {
+      return 1;
+    }
+  }
+  catch (const std::exception & ex) {
+    std::cout << "Error: " << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/// Main of the peek command.
+/// @param argc the number of command-line arguments.
+/// @param argv the command-line arguments, starting with the command name.
+/// @return the exit status.
+int peek_main(int argc, char * argv[]) {
+  try {
+    std::string output_filename;
+
+    // parse options
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-') {
+      std::string arg(argv[argi]);
+      if (arg == "-o") {
+        if (argi + 1 >= argc) {
+          std::ostringstream message_buffer;
+          message_buffer << "Too few arguments for \"" << arg << "\"";
+          throw std::invalid_argument(message_buffer.str());
+        }
+
+        output_filename = argv[argi + 1];
+        argi++;
+      }
+      else {
+        std::ostringstream message_buffer;
+        message_buffer << "Unknown option \"" << arg << "\"";
+        throw std::invalid_argument(message_buffer.str());
+      }
+
+      argi++;
+    }
+
+    if (argc - argi < 3) {
+      throw std::invalid_argument("Too few arguments.");
+    }
+
+    if (argc - argi > 3) {
+      throw std::invalid_argument("Too many arguments.");
+    }
+
+    std::string filename(argv[argi]);
+    uint64_t offset = std::stoull(argv[argi + 1], nullptr, 0);
+    uint64_t size = std::stoull(argv[argi + 2], nullptr, 0);
+
+    // only the pages of the range are decompressed, as they are touched
+    LazyRomImage image(filename);
+    if (size > image.size() || offset > image.size() - size) {
+      std::ostringstream message_buffer;
+      message_buffer << filename << ": " << "Range out of the ROM (size " << image.size() << ").";
+      throw std::out_of_range(message_buffer.str());
+    }
+
+    const char * data = image.data() + offset;
+    if (!output_filename.empty()) {
+      std::ofstream out;
+      out.exceptions(std::ios::badbit | std::ios::failbit);
+      out.open(output_filename, std::ios::binary);
+
+      // copy the pages in user mode, since the kernel may not fault them in
+      std::vector<char> buffer(static_cast<size_t>(std::min<uint64_t>(size, 1024 * 1024)));
+      for (uint64_t position = 0; position < size; position += buffer.size()) {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(size - position, buffer.size()));
+        memcpy(buffer.data(), data + position, length);
+        out.write(buffer.data(), static_cast<std::streamsize>(length));
+      }
+    }
+    else {
+      for (uint64_t line = 0; line < size; line += 16) {
+        char text[96];
+        int length = snprintf(text, sizeof(text), "%08llx:", static_cast<unsigned long long>(offset + line));
+        std::string ascii;
+        for (uint64_t i = line; i < line + 16; i++) {
+          if (i < size) {
+            unsigned char c = static_cast<unsigned char>(data[i]);
+            length += snprintf(text + length, sizeof(text) - length, " %02x", c);
+            ascii += (c >= 0x20 && c < 0x7f) ? static_cast<char>(c) : '.';
+          }
+          else {
+            length += snprintf(text + length, sizeof(text) - length, "   ");
+          }
+        }
+        std::cout << text << "  " << ascii << std::endl;
+      }
+    }
+
+    if (!image.error().empty()) {
+      throw std::runtime_error(image.error());
+    }
+  }
+  catch (const std::exception & ex) {
+    std::cout << "Error: " << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/// Main of the serve command.
+/// @param argc the number of command-line arguments.
+/// @param argv the command-line arguments, starting with the command name.
+/// @return the exit status.
+int serve_main(int argc, char * argv[]) {
+  try {
+    unsigned int socket_mode = kRomServerDefaultSocketMode;
+    size_t max_connections = kRomServerDefaultMaxConnections;
+
+    // parse options
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-') {
+      std::string arg(argv[argi]);
+      if (arg == "--mode" || arg == "--max-connections") {
+        if (argi + 1 >= argc) {
+          std::ostringstream message_buffer;
+          message_buffer << "Too few arguments for \"" << arg << "\"";
+          throw std::invalid_argument(message_buffer.str());
+        }
+
+        if (arg == "--mode") {
+          socket_mode = static_cast<unsigned int>(std::stoul(argv[argi + 1], nullptr, 8));
+        }
+        else {
+          max_connections = std::stoul(argv[argi + 1]);
+        }
+        argi++;
+      }
+      else {
+        std::ostringstream message_buffer;
+        message_buffer << "Unknown option \"" << arg << "\"";
+        throw std::invalid_argument(message_buffer.str());
+      }
+
+      argi++;
+    }
+
+    if (argi == argc) {
+      throw std::invalid_argument("No socket path.");
+    }
+
+    if (argi + 1 < argc) {
+      throw std::invalid_argument("Too many arguments.");
+    }
+
+    RomServer server(argv[argi], socket_mode, max_connections);
+    std::cout << "Listening on " << argv[argi] << std::endl;
+    server.run();
+  }
+  catch (const std::exception & ex) {
+    std::cout << "Error: " << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/// Converts 2SF files through AsyncLoader, showing the progress of each file.
+/// @param filenames the paths to 2sf files.
+/// @param rom_filenames the paths to the output ROM files.
+/// @param output_mode the format of the output ROM files.
+/// @param thread_count the number of loads in flight, 0 for the default.
+/// @return the number of files failed to be converted.
+///
+/// @remarks SIGINT cancels the loads in progress instead of terminating.
+int convert_with_progress(const std::vector<std::string> & filenames, const std::vector<std::string> & rom_filenames,
+    RomOutputMode output_mode, unsigned int thread_count) {
+  /// The Load struct represents a file being loaded.
+  struct Load {
+    size_t index;
+    LoadHandle handle;
+    std::shared_ptr<std::atomic<uint64_t>> completed;
+    std::shared_ptr<std::atomic<uint64_t>> total;
+  };
+
+  if (thread_count == 0) {
+    thread_count = get_default_thread_count();
+  }
+
+  g_interrupted = 0;
+  auto previous_handler = std::signal(SIGINT, handle_interrupt);
+
+  // keep a load in flight per thread, so that at most that many ROMs are held
+  AsyncLoader loader(thread_count);
+  unsigned int write_thread_count = std::max(get_default_thread_count() / thread_count, 1u);
+  std::deque<Load> loads;
+  size_t next = 0;
+  int failures = 0;
+  while (next < filenames.size() || !loads.empty()) {
+    while (next < filenames.size() && loads.size() < thread_count && !g_interrupted) {
+      Load load;
+      load.index = next++;
+      load.completed = std::make_shared<std::atomic<uint64_t>>(0);
+      load.total = std::make_shared<std::atomic<uint64_t>>(0);
+      std::shared_ptr<std::atomic<uint64_t>> completed = load.completed;
+      std::shared_ptr<std::atomic<uint64_t>> total = load.total;
+      load.handle = loader.submit(filenames[load.index], [completed, total](uint64_t done, uint64_t size) {
+        *completed = done;
+        *total = size;
+      });
+      loads.push_back(std::move(load));
+    }
+    if (loads.empty()) {
+      break;
+    }
+
+    // show the progress of the oldest load until it completes
+    Load & load = loads.front();
+    const std::string & filename = filenames[load.index];
+    while (load.handle.future().wait_for(kProgressInterval) != std::future_status::ready) {
+      if (g_interrupted) {
+        for (Load & pending : loads) {
+          pending.handle.cancel();
+        }
+      }
+
+      uint64_t total = *load.total;
+      int percent = (total != 0) ? static_cast<int>(*load.completed * 100 / total) : 0;
+      std::cout << "\r" << filename << ": " << percent << "%" << std::flush;
+    }
+
+    try {
+      const std::vector<char> & rom = load.handle.future().get();
+      write_rom(rom_filenames[load.index], rom.data(), rom.size(), output_mode, write_thread_count);
+      std::cout << "\r" << filename << ": " << "100%" << std::endl;
+    }
+    catch (const std::exception & ex) {
+      std::cout << "\r" << "Error: " << ex.what() << std::endl;
+      failures++;
+    }
+    loads.pop_front();
+  }
+
+  // the files never submitted are failures too
+  if (g_interrupted && next < filenames.size()) {
+    std::cout << "Interrupted, " << (filenames.size() - next) << " files not converted." << std::endl;
+    failures += static_cast<int>(filenames.size() - next);
+  }
+  std::signal(SIGINT, previous_handler);
+  return failures;
+}
+
+/// Main of 2SF2ROM.
+/// @param argc the number of command-line arguments.
+/// @param argv the command-line arguments.
+/// @return the exit status.
+int main(int argc, char * argv[]) {
+  try {
+    std::string output_filename;
+    BatchOptions options;
+    bool show_stats = false;
+    bool show_progress = false;
+    std::string output_mode_option;
+
+    // show usage if arg is empty
+    if (argc <= 1) {
+      show_usage(argv[0]);
+      return 1;
+    }
+
+    // run the command if specified
+    std::string command(argv[1]);
+    if (command == "pack") {
+      return pack_main(argc - 1, argv + 1);
+    }
+    else if (command == "unpack") {
+      return unpack_main(argc - 1, argv + 1);
+    }
+    else if (command == "dedup") {
+      return dedup_main(argc - 1, argv + 1);
+    }
+    else if (command == "optimize") {
+      return optimize_main(argc - 1, argv + 1);
+    }
+    else if (command == "flatten") {
+      return flatten_main(argc - 1, argv + 1);
+    }
+    else if (command == "bench") {
+      return bench_main(argc - 1, argv + 1);
+    }
+    else if (command == "tar") {
+      return tar_main(argc - 1, argv + 1);
+    }
+    else if (command == "verify") {
+      return verify_main(argc - 1, argv + 1);
+    }
+    else if (command == "carve") {
+      return carve_main(argc - 1, argv + 1);
+    }
+    else if (command == "peek") {
+      return peek_main(argc - 1, argv + 1);
+    }
+    else if (command == "serve") {
+      return serve_main(argc - 1, argv + 1);
+    }
+
+    // parse options
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-') {
+      std::string arg(argv[argi]);
+      if (arg == "--help") {
+        show_usage(argv[0]);
+        return 1;
+      }
+      else if (arg == "-o") {
+        if (argi + 1 >= argc) {
+          std::ostringstream message_buffer;
+          message_buffer << "Too few arguments for \"" << arg << "\"";
+          throw std::invalid_argument(message_buffer.str());
+        }
+
+        output_filename = argv[argi + 1];
+        argi++;
+      }
+      else if (arg == "--gzip" || arg == "--parallel-write" || arg == "--direct-io") {
+        // each option selects a different writer, so only one can be used
+        if (!output_mode_option.empty() && output_mode_option != arg) {
+          std::ostringstream message_buffer;
+          message_buffer << "\"" << output_mode_option << "\" cannot be combined with \"" << arg << "\"";
+          throw std::invalid_argument(message_buffer.str());
+        }
+        output_mode_option = arg;
+
+        if (arg == "--gzip") {
+          options.output_mode = RomOutputMode::kChunkedGzip;
+        }
+        else if (arg == "--parallel-write") {
+          options.output_mode = RomOutputMode::kParallelRaw;
+        }
+        else {
+          options.output_mode = RomOutputMode::kDirectRaw;
+          options.drop_input_cache = true;
+        }
+      }
+      else if (arg == "--cache-size") {
+        if (argi + 1 >= argc) {
+          std::ostringstream message_buffer;
+          message_buffer << "Too few arguments for \"" << arg << "\"";
+          throw std::invalid_argument(message_buffer.str());
+        }
+
+        options.cache_capacity = std::stoul(argv[argi + 1]) * 1024 * 1024;
+        argi++;
+      }
+      else if (arg == "--cache-dedup") {
+        options.cache_storage = LibCacheStorage::kDedup;
+      }
+      else if (arg == "--cache-compress") {
+        options.cache_storage = LibCacheStorage::kCompressed;
+      }
+      else if (arg == "--stats") {
+        show_stats = true;
+      }
+      else if (arg == "--progress") {
+        show_progress = true;
+      }
+      else if (arg == "--numa") {
+        options.numa = true;
+      }
+      else if (arg == "-j") {
+        if (argi + 1 >= argc) {
+          std::ostringstream message_buffer;
+          message_buffer << "Too few arguments for \"" << arg << "\"";
+          throw std::invalid_argument(message_buffer.str());
+        }
+
+        std::string threads(argv[argi + 1]);
+        if (threads == "auto") {
+          options.thread_count = 0;
+        }
+        else {
+          options.thread_count = static_cast<unsigned int>(std::stoul(threads));
+          if (options.thread_count == 0) {
+            throw std::invalid_argument("The number of threads must be positive.");
+          }
+        }
+        argi++;
+      }
+      else {
+        std::ostringstream message_buffer;
+        message_buffer << "Unknown option \"" << arg << "\"";
+        throw std::invalid_argument(message_buffer.str());
+      }
+
+      argi++;
+    }
+
+    if (argi == argc) {
+      throw std::invalid_argument("No input files.");
+    }
+
+    if (!output_filename.empty() && argi + 1 < argc) {
+      throw std::invalid_argument("Too many arguments.");
+    }
+
+    // determine filenames
+    std::vector<std::string> filenames;
+    std::vector<std::string> rom_filenames;
+    for (; argi < argc; argi++) {
+      std::string filename(argv[argi]);
+      std::string rom_filename(output_filename);
+      if (rom_filename.empty()) {
+        rom_filename = get_rom_filename(filename);
+        if (options.output_mode == RomOutputMode::kChunkedGzip) {
+          rom_filename += ".gz";
+        }
+      }
+      filenames.push_back(filename);
+      rom_filenames.push_back(rom_filename);
+    }
+
+    if (show_progress) {
+      return (convert_with_progress(filenames, rom_filenames, options.output_mode, options.thread_count) != 0) ? 1 : 0;
+    }
+
+    BatchConverter converter(options);
+    for (size_t i = 0; i < filenames.size(); i++) {
+      converter.add(filenames[i], rom_filenames[i]);
+    }
+
+    // load rom images and write them to files
+    int failures = converter.run();
+
+    if (show_stats) {
+      LibCacheStats stats = converter.cache_stats();
+      std::cout << "Lib cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+        << stats.evictions << " evictions, " << stats.inflated_bytes << " bytes inflated, "
+        << "peak " << stats.peak_size << " bytes, " << stats.shared_pages << " shared pages" << std::endl;
+    }
+
+    if (options.thread_count == 0 || show_stats) {
+      ConcurrencySettings settings = converter.concurrency();
+      double busy_seconds = settings.io_seconds + settings.inflate_seconds;
+      double io_share = (busy_seconds > 0) ? settings.io_seconds / busy_seconds : 0;
+      std::cout << "Concurrency: " << settings.workers << " threads, "
+        << settings.outstanding_io << " outstanding writes, "
+        << static_cast<int>(io_share * 100 + 0.5) << "% of time on I/O" << std::endl;
+    }
+
+    if (failures != 0) {
+      return 1;
+    }
   }
-  catch (std::exception ex) {
+  catch (const std::exception & ex) {
     std::cout << "Error: " << ex.what() << std::endl;
     return 1;
   }
@@ -11,20 +11,54 @@
 #include "ZlibReader.h"
 
 ZlibReader::ZlibReader() :
+	zdata(NULL),
+	zsize(0),
+	z_alloc(Z_NULL),
+	z_free(Z_NULL),
+	z_opaque(Z_NULL),
 	initialized(false),
-	zbuf_crc(0)
+	read_cancelled(false)
 {
 	reset_zlib();
 	initialized = true;
 }
 
 ZlibReader::ZlibReader(const void * buf, size_t size) :
-	initialized(false)
+	zdata(NULL),
+	zsize(0),
+	z_alloc(Z_NULL),
+	z_free(Z_NULL),
+	z_opaque(Z_NULL),
+	initialized(false),
+	read_cancelled(false)
 {
 	assign(buf, size);
 	initialized = true;
 }
 
+ZlibReader::ZlibReader(const void * buf, size_t size, bool copy,
+	alloc_func zalloc, free_func zfree, voidpf opaque) :
+	zdata(NULL),
+	zsize(0),
+	z_alloc(zalloc),
+	z_free(zfree),
+	z_opaque(opaque),
+	initialized(false),
+	read_cancelled(false)
+{
+	if (copy)
+	{
+		assign(buf, size);
+	}
+	else
+	{
+		zdata = (const uint8_t *) buf;
+		zsize = size;
+		reset_zlib();
+	}
+	initialized = true;
+}
+
 ZlibReader::~ZlibReader()
 {
 	inflateEnd(&z);
@@ -39,9 +73,9 @@ bool ZlibReader::reset_zlib()
 		inflateEnd(&z);
 	}
 
-	z.zalloc = Z_NULL;
-	z.zfree = Z_NULL;
-	z.opaque = Z_NULL;
+	z.zalloc = z_alloc;
+	z.zfree = z_free;
+	z.opaque = z_opaque;
 	zresult = inflateInit(&z);
 
 	zpos = 0;
@@ -54,11 +88,9 @@ bool ZlibReader::reset_zlib()
 
 void ZlibReader::assign(const void * buf, size_t size)
 {
-	for (size_t i = 0; i < size; i++)
-	{
-		zbuf.push_back(((uint8_t *)buf)[i]);
-	}
-	zbuf_crc = ::crc32(0L, (const Bytef *) buf, (uInt) size);
+	zbuf.insert(zbuf.end(), (const uint8_t *) buf, (const uint8_t *) buf + size);
+	zdata = zbuf.data();
+	zsize = zbuf.size();
 
 	reset_zlib();
 }
@@ -67,26 +99,54 @@ int ZlibReader::read(const void * buf, size_t size)
 {
 	int zresult;
 
-	if (zpos >= zbuf.size())
+	if (zpos >= zsize)
 	{
 		return 0;
 	}
 
-	uInt z_avail_in_old = (uInt) (zbuf.size() - zpos);
-
-	z.next_in = ((Bytef *) &zbuf[0]) + zpos;
-	z.avail_in = z_avail_in_old;
-	z.next_out = (Bytef *) buf;
-	z.avail_out = (uInt) size;
-	zresult = inflate(&z, Z_SYNC_FLUSH);
-	if (zresult != Z_OK && zresult != Z_STREAM_END)
+	// inflate at once, or by PROGRESS_INTERVAL to report the progress
+	size_t bytes_read = 0;
+	while (bytes_read < size)
 	{
-		return -1;
+		size_t chunk_size = size - bytes_read;
+		if (progress_callback && chunk_size > PROGRESS_INTERVAL)
+		{
+			chunk_size = PROGRESS_INTERVAL;
+		}
+
+		uInt z_avail_in_old = (uInt) (zsize - zpos);
+
+		z.next_in = ((Bytef *) zdata) + zpos;
+		z.avail_in = z_avail_in_old;
+		z.next_out = (Bytef *) buf + bytes_read;
+		z.avail_out = (uInt) chunk_size;
+		zresult = inflate(&z, Z_SYNC_FLUSH);
+		if (zresult != Z_OK && zresult != Z_STREAM_END)
+		{
+			if (bytes_read == 0)
+			{
+				return -1;
+			}
+			break;
+		}
+
+		zpos += (z_avail_in_old - z.avail_in);
+
+		size_t chunk_read = (chunk_size - z.avail_out);
+		bytes_read += chunk_read;
+
+		if (progress_callback && !progress_callback(pos + bytes_read))
+		{
+			read_cancelled = true;
+			break;
+		}
+
+		if (zresult == Z_STREAM_END || chunk_read < chunk_size)
+		{
+			break;
+		}
 	}
 
-	zpos += (z_avail_in_old - z.avail_in);
-
-	size_t bytes_read = (size - z.avail_out);
 	pos += bytes_read;
 
 	crc = ::crc32(crc, (const Bytef *) buf, (uInt) bytes_read);
@@ -9,14 +9,27 @@
 #include <zlib.h>
 #include <zconf.h>
 
+#include <functional>
 #include <string>
 #include <vector>
 
 class ZlibReader
 {
 public:
+	// Called with the total number of bytes read, returns false to cancel.
+	typedef std::function<bool(size_t)> ProgressCallback;
+
+	// Number of bytes inflated between the calls of ProgressCallback.
+	static const size_t PROGRESS_INTERVAL = 1024 * 1024;
+
 	ZlibReader();
 	ZlibReader(const void * buf, size_t size);
+
+	// Reads the buffer without copying it when copy is false, in which case
+	// the buffer must outlive the reader. zalloc, zfree and opaque are passed
+	// to zlib for the inflate state.
+	ZlibReader(const void * buf, size_t size, bool copy,
+		alloc_func zalloc = Z_NULL, free_func zfree = Z_NULL, voidpf opaque = Z_NULL);
 	virtual ~ZlibReader();
 
 	void assign(const void * buf, size_t size);
@@ -57,6 +70,16 @@ public:
 		}
 	}
 
+	inline void set_progress_callback(ProgressCallback callback)
+	{
+		progress_callback = callback;
+	}
+
+	inline bool cancelled() const
+	{
+		return read_cancelled;
+	}
+
 	inline void rewind()
 	{
 		reset_zlib();
@@ -69,9 +92,9 @@ public:
 
 	inline const uint8_t * compressed_data() const
 	{
-		if (zbuf.size() != 0)
+		if (zsize != 0)
 		{
-			return &zbuf[0];
+			return zdata;
 		}
 		else
 		{
@@ -82,7 +105,7 @@ public:
 
 	inline size_t compressed_size() const
 	{
-		return zbuf.size();
+		return zsize;
 	}
 
 	static inline uint32_t crc32(const void * buf, size_t size)
@@ -93,7 +116,7 @@ public:
 
 	inline uint32_t compressed_crc32() const
 	{
-		return zbuf_crc;
+		return crc32(compressed_data(), zsize);
 	}
 
 	inline uint32_t crc32() const
@@ -120,12 +143,18 @@ public:
 
 private:
 	std::vector<uint8_t> zbuf;
-	uLong zbuf_crc;
+	const uint8_t * zdata;
+	size_t zsize;
 	size_t zpos;
 	size_t pos;
 	uLong crc;
 	z_stream z;
+	alloc_func z_alloc;
+	free_func z_free;
+	voidpf z_opaque;
 	bool initialized;
+	ProgressCallback progress_callback;
+	bool read_cancelled;
 
 	bool reset_zlib();
 
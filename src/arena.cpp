@@ -0,0 +1,92 @@
+/// @file
+/// Arena class implementation.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include <zlib.h>
+
+#include "arena.hpp"
+
+/// Constructs a new Arena.
+Arena::Arena(size_t block_size) :
+    block_(0),
+    offset_(0),
+    block_size_(block_size) {
+}
+
+/// Allocates memory from the arena.
+void * Arena::allocate(size_t size, size_t alignment) {
+  // try the current block
+  if (block_ < blocks_.size()) {
+    Block & block = blocks_[block_];
+    uintptr_t address = reinterpret_cast<uintptr_t>(block.data.get()) + offset_;
+    size_t padding = (alignment - (address & (alignment - 1))) & (alignment - 1);
+    if (offset_ + padding + size <= block.size) {
+      offset_ += padding + size;
+      return reinterpret_cast<void *>(address + padding);
+    }
+    block_++;
+  }
+
+  // reuse the next block if it is large enough, or insert a new block
+  size_t required_size = size + alignment;
+  if (block_ >= blocks_.size() || blocks_[block_].size < required_size) {
+    Block block;
+    block.size = std::max(block_size_, required_size);
+    block.data.reset(new char[block.size]);
+    blocks_.insert(blocks_.begin() + block_, std::move(block));
+  }
+
+  Block & block = blocks_[block_];
+  uintptr_t address = reinterpret_cast<uintptr_t>(block.data.get());
+  size_t padding = (alignment - (address & (alignment - 1))) & (alignment - 1);
+  offset_ = padding + size;
+  return reinterpret_cast<void *>(address + padding);
+}
+
+/// Returns the current position.
+Arena::Mark Arena::mark() const {
+  return Mark{ block_, offset_ };
+}
+
+/// Releases the memory allocated after a position.
+void Arena::rewind(const Mark & mark) {
+  block_ = mark.block;
+  offset_ = mark.offset;
+}
+
+/// Returns the total size of the blocks.
+size_t Arena::capacity() const {
+  size_t capacity = 0;
+  for (const Block & block : blocks_) {
+    capacity += block.size;
+  }
+  return capacity;
+}
+
+/// Returns the arena of the calling thread.
+Arena & Arena::thread_arena() {
+  static thread_local Arena arena;
+  return arena;
+}
+
+/// Allocates memory for zlib from the arena given as opaque.
+void * Arena::zalloc(void * opaque, unsigned int items, unsigned int size) {
+  // an exception must not unwind through zlib, which reports Z_MEM_ERROR instead
+  try {
+    return static_cast<Arena *>(opaque)->allocate(static_cast<size_t>(items) * size);
+  }
+  catch (const std::bad_alloc &) {
+    return Z_NULL;
+  }
+}
+
+/// Does nothing, since the memory is released by rewinding the arena.
+void Arena::zfree(void *, void *) {
+}
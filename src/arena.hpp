@@ -0,0 +1,123 @@
+/// @file
+/// Arena class header.
+
+#ifndef ARENA_HPP_
+#define ARENA_HPP_
+
+#include <stddef.h>
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/// The default size of arena blocks, which holds a zlib inflate state.
+constexpr size_t kArenaBlockSize = 256 * 1024;
+
+/// The Arena class is a bump allocator for transient allocations.
+///
+/// Memory is taken from the current block by advancing an offset, and is
+/// released all at once by rewinding the arena to a mark. Blocks are kept
+/// after rewinding, so an arena which is repeatedly used for similar work
+/// no longer allocates from the heap.
+///
+/// Only the zlib inflate states of the loader are taken from the arena.
+/// PSFFile buffers and tags, and error messages, remain on the heap, since
+/// the programs outlive a single conversion in batch mode.
+class Arena {
+public:
+  /// The Mark struct represents a position of the arena.
+  struct Mark {
+    /// The index of the block.
+    size_t block;
+
+    /// The offset in the block.
+    size_t offset;
+  };
+
+  /// Constructs a new Arena.
+  /// @param block_size the size of each block.
+  explicit Arena(size_t block_size = kArenaBlockSize);
+
+  Arena(const Arena &) = delete;
+  Arena & operator=(const Arena &) = delete;
+
+  /// Allocates memory from the arena.
+  /// @param size the size of the memory.
+  /// @param alignment the alignment of the memory, which must be a power of 2.
+  /// @return the memory, valid until the arena is rewound before it.
+  void * allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+  /// Returns the current position.
+  /// @return the current position.
+  Mark mark() const;
+
+  /// Releases the memory allocated after a position.
+  /// @param mark the position.
+  void rewind(const Mark & mark);
+
+  /// Returns the total size of the blocks.
+  /// @return the total size of the blocks.
+  size_t capacity() const;
+
+  /// Returns the arena of the calling thread.
+  /// @return the arena of the calling thread.
+  static Arena & thread_arena();
+
+  /// Allocates memory for zlib from the arena given as opaque.
+  /// @return the memory, or Z_NULL if the heap is exhausted.
+  static void * zalloc(void * opaque, unsigned int items, unsigned int size);
+
+  /// Does nothing, since the memory is released by rewinding the arena.
+  static void zfree(void * opaque, void * address);
+
+private:
+  /// The Block struct represents a block of memory.
+  struct Block {
+    /// The memory.
+    std::unique_ptr<char[]> data;
+
+    /// The size of the memory.
+    size_t size;
+  };
+
+  /// The blocks.
+  std::vector<Block> blocks_;
+
+  /// The index of the current block.
+  size_t block_;
+
+  /// The offset in the current block.
+  size_t offset_;
+
+  /// The size of each block.
+  size_t block_size_;
+};
+
+/// The ArenaScope class rewinds an arena to the position at its construction
+/// when it is destructed.
+class ArenaScope {
+public:
+  /// Constructs a new ArenaScope.
+  /// @param arena the arena.
+  explicit ArenaScope(Arena & arena) :
+      arena_(arena),
+      mark_(arena.mark()) {
+  }
+
+  ArenaScope(const ArenaScope &) = delete;
+  ArenaScope & operator=(const ArenaScope &) = delete;
+
+  /// Rewinds the arena.
+  ~ArenaScope() {
+    arena_.rewind(mark_);
+  }
+
+private:
+  /// The arena.
+  Arena & arena_;
+
+  /// The position at the construction.
+  Arena::Mark mark_;
+};
+
+#endif // !ARENA_HPP_
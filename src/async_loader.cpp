@@ -0,0 +1,125 @@
+/// @file
+/// AsyncLoader class implementation.
+
+#include <stdint.h>
+
+#include <atomic>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async_loader.hpp"
+#include "parallel.hpp"
+#include "rom_loader.hpp"
+
+/// Constructs a new AsyncLoader.
+AsyncLoader::AsyncLoader(unsigned int thread_count) :
+    stopping_(false) {
+  if (thread_count == 0) {
+    thread_count = get_default_thread_count();
+  }
+
+  for (unsigned int i = 0; i < thread_count; i++) {
+    threads_.emplace_back(&AsyncLoader::work, this);
+  }
+}
+
+/// Cancels the pending loads and stops the worker threads.
+AsyncLoader::~AsyncLoader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    for (Task & task : tasks_) {
+      *task.cancelled = true;
+    }
+  }
+  condition_.notify_all();
+
+  for (std::thread & thread : threads_) {
+    thread.join();
+  }
+}
+
+/// Starts loading a 2SF file.
+LoadHandle AsyncLoader::submit(const std::string & filename, LoadProgressCallback progress) {
+  Task task;
+  task.filename = filename;
+  task.progress = std::move(progress);
+  task.cancelled = std::make_shared<std::atomic<bool>>(false);
+
+  LoadHandle handle;
+  handle.future_ = task.promise.get_future().share();
+  handle.cancelled_ = task.cancelled;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+  }
+  condition_.notify_one();
+  return handle;
+}
+
+/// Runs queued tasks until the loader is stopped.
+void AsyncLoader::work() {
+  for (;;) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+
+    try {
+      task.promise.set_value(load(task));
+    }
+    catch (...) {
+      task.promise.set_exception(std::current_exception());
+    }
+  }
+}
+
+/// Loads a ROM image.
+std::vector<char> AsyncLoader::load(const Task & task) {
+  auto check_cancelled = [&task]() {
+    if (*task.cancelled) {
+      std::ostringstream message_buffer;
+      message_buffer << task.filename << ": " << "Loading cancelled.";
+      throw LoadCancelledError(message_buffer.str());
+    }
+  };
+
+  check_cancelled();
+  std::vector<PSFProgram> programs = resolve_2sf(task.filename);
+
+  uint64_t total = 0;
+  for (const PSFProgram & program : programs) {
+    total += program.load_size;
+  }
+
+  std::vector<char> rom(get_rom_size(programs), 0);
+  uint64_t completed = 0;
+  for (const PSFProgram & program : programs) {
+    check_cancelled();
+    inflate_program(program, rom.data() + program.load_offset, [&](size_t position) {
+      if (task.progress) {
+        task.progress(completed + position, total);
+      }
+      return !*task.cancelled;
+    });
+    completed += program.load_size;
+  }
+
+  if (task.progress) {
+    task.progress(total, total);
+  }
+  return rom;
+}
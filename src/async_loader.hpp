@@ -0,0 +1,119 @@
+/// @file
+/// AsyncLoader class header.
+
+#ifndef ASYNC_LOADER_HPP_
+#define ASYNC_LOADER_HPP_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// The function called with the number of bytes decompressed so far and the
+/// total number of bytes to be decompressed.
+typedef std::function<void(uint64_t, uint64_t)> LoadProgressCallback;
+
+/// The LoadHandle class represents a pending load of a ROM image.
+class LoadHandle {
+public:
+  /// Constructs an empty LoadHandle.
+  LoadHandle() = default;
+
+  /// Returns the future of the ROM image.
+  /// @return the future, which throws LoadCancelledError if cancelled.
+  const std::shared_future<std::vector<char>> & future() const {
+    return future_;
+  }
+
+  /// Requests cancellation of the load.
+  ///
+  /// @remarks A load which has not started yet is never started, and a load
+  /// in progress stops at the next progress report.
+  void cancel() {
+    if (cancelled_) {
+      *cancelled_ = true;
+    }
+  }
+
+private:
+  friend class AsyncLoader;
+
+  /// The future of the ROM image.
+  std::shared_future<std::vector<char>> future_;
+
+  /// True if the cancellation is requested.
+  std::shared_ptr<std::atomic<bool>> cancelled_;
+};
+
+/// The AsyncLoader class loads 2SF files into ROM images on worker threads.
+///
+/// Each file is loaded the same way as load_2sf. The progress is reported
+/// from the worker thread in bytes of decompressed programs, at most every
+/// ZlibReader::PROGRESS_INTERVAL bytes.
+class AsyncLoader {
+public:
+  /// Constructs a new AsyncLoader.
+  /// @param thread_count the number of worker threads, 0 for the default.
+  explicit AsyncLoader(unsigned int thread_count = 0);
+
+  AsyncLoader(const AsyncLoader &) = delete;
+  AsyncLoader & operator=(const AsyncLoader &) = delete;
+
+  /// Cancels the pending loads and stops the worker threads.
+  ~AsyncLoader();
+
+  /// Starts loading a 2SF file.
+  /// @param filename the path to 2SF file.
+  /// @param progress the function called on the progress of the load.
+  /// @return the handle of the load.
+  LoadHandle submit(const std::string & filename, LoadProgressCallback progress = nullptr);
+
+private:
+  /// The Task struct represents a queued load.
+  struct Task {
+    /// The path to 2SF file.
+    std::string filename;
+
+    /// The function called on the progress.
+    LoadProgressCallback progress;
+
+    /// The promise of the ROM image.
+    std::promise<std::vector<char>> promise;
+
+    /// True if the cancellation is requested.
+    std::shared_ptr<std::atomic<bool>> cancelled;
+  };
+
+  /// Runs queued tasks until the loader is stopped.
+  void work();
+
+  /// Loads a ROM image.
+  /// @param task the task.
+  /// @return the ROM image.
+  static std::vector<char> load(const Task & task);
+
+  /// The worker threads.
+  std::vector<std::thread> threads_;
+
+  /// The queued tasks.
+  std::deque<Task> tasks_;
+
+  /// The mutex for tasks_ and stopping_.
+  std::mutex mutex_;
+
+  /// Notified when a task is queued or the loader is stopped.
+  std::condition_variable condition_;
+
+  /// True if the loader is being destructed.
+  bool stopping_;
+};
+
+#endif // !ASYNC_LOADER_HPP_
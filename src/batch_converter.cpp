@@ -0,0 +1,290 @@
+/// @file
+/// BatchConverter class implementation.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+
+#if defined(__linux__) || defined(__FreeBSD__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "batch_converter.hpp"
+#include "concurrency_controller.hpp"
+#include "numa.hpp"
+#include "parallel.hpp"
+#include "rom_loader.hpp"
+#include "rom_writer.hpp"
+
+namespace {
+
+/// Drops a file from the page cache.
+/// @param filename the path to the file.
+void drop_page_cache(const std::string & filename) {
+#if defined(__linux__) || defined(__FreeBSD__)
+  int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd != -1) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+#else
+  (void)filename;
+#endif
+}
+
+} // namespace
+
+/// Constructs a new BatchConverter.
+BatchConverter::BatchConverter(const BatchOptions & options) :
+    options_(options) {
+  // share the capacity among the caches of the nodes
+  nodes_ = options_.numa ? get_numa_nodes() : std::vector<NumaNode>(1, NumaNode{ 0, std::vector<unsigned int>() });
+  for (size_t node = 0; node < nodes_.size(); node++) {
+    caches_.emplace_back(new LibCache(options_.cache_capacity / nodes_.size(), options_.cache_storage));
+  }
+}
+
+/// Adds a file to be converted.
+void BatchConverter::add(const std::string & filename, const std::string & output_filename) {
+  Job job;
+  job.filename = filename;
+  job.output_filename = output_filename;
+  jobs_.push_back(std::move(job));
+}
+
+/// Converts all added files.
+int BatchConverter::run() {
+  typedef std::chrono::steady_clock Clock;
+  auto seconds_since = [](Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+  };
+
+  // in the automatic mode, allow twice the hardware threads to hide I/O
+  bool adaptive = (options_.thread_count == 0);
+  unsigned int max_workers = adaptive ? get_default_thread_count() * 2 : options_.thread_count;
+  ConcurrencyController controller(max_workers, adaptive);
+
+  // the hardware threads are shared by the workers, so a ROM is compressed
+  // or written by the share of its worker
+  unsigned int write_thread_count = std::max(get_default_thread_count() / max_workers, 1u);
+
+  std::atomic<int> failures(0);
+  std::mutex output_mutex;
+  auto report_error = [&](const std::exception & ex) {
+    failures++;
+    if (options_.report_errors) {
+      std::lock_guard<std::mutex> lock(output_mutex);
+      std::cout << "Error: " << ex.what() << std::endl;
+    }
+  };
+
+  // resolve all files, and group them by their psflibs
+  std::vector<std::string> filenames;
+  for (const Job & job : jobs_) {
+    filenames.push_back(job.filename);
+  }
+  Clock::time_point resolve_start = Clock::now();
+  std::vector<PSFLibSet> lib_sets = resolve_2sf_sets(filenames,
+    [&report_error](size_t, const std::exception & ex) {
+      report_error(ex);
+    }, max_workers);
+  controller.add_time(0, seconds_since(resolve_start));
+
+  /// The Chunk struct represents files of a set converted by a thread.
+  struct Chunk {
+    /// The set of the files.
+    const PSFLibSet * lib_set;
+
+    /// The range of the files in the set.
+    size_t begin;
+    size_t end;
+
+    /// The node whose cache the set is composed from.
+    size_t node;
+  };
+
+  // assign each set to the node with the fewest files, and split it into
+  // chunks (a single thread converts each set at once)
+  size_t node_count = caches_.size();
+  size_t chunk_size = (max_workers > 1) ? kBatchChunkSize : SIZE_MAX;
+  std::vector<Chunk> chunks;
+  std::vector<std::vector<size_t>> node_chunks(node_count);
+  std::vector<size_t> node_files(node_count, 0);
+  for (const PSFLibSet & lib_set : lib_sets) {
+    size_t count = lib_set.programs.size();
+    size_t node = std::min_element(node_files.begin(), node_files.end()) - node_files.begin();
+    node_files[node] += count;
+
+    // tell the cache how many files depend on each psflib
+    for (const PSFProgram & lib_program : lib_set.lib_programs) {
+      caches_[node]->add_dependents(lib_program.filename, count);
+    }
+
+    for (size_t begin = 0; begin < count; ) {
+      size_t end = begin + std::min(chunk_size, count - begin);
+      node_chunks[node].push_back(chunks.size());
+      chunks.push_back(Chunk{ &lib_set, begin, end, node });
+      begin = end;
+    }
+  }
+
+  auto convert_chunk = [&](const Chunk & chunk, LibCache & cache) {
+    const PSFLibSet & lib_set = *chunk.lib_set;
+
+    // the buffers are first touched by this thread, so they are allocated
+    // on its node
+    std::vector<char> rom;
+    std::vector<char> undo;
+    bool composed = false;
+    for (size_t i = chunk.begin; i < chunk.end; i++) {
+      const PSFProgram & program = lib_set.programs[i];
+      const Job & job = jobs_[lib_set.file_indices[i]];
+
+      // the file has been read entirely when resolved, and is never read
+      // again, unlike the psflibs
+      if (options_.drop_input_cache) {
+        drop_page_cache(program.filename);
+      }
+
+      // a parked worker gives its buffers back, so that the memory follows
+      // the number of active workers rather than all the threads
+      if (!controller.try_begin_work()) {
+        std::vector<char>().swap(rom);
+        std::vector<char>().swap(undo);
+        composed = false;
+        controller.begin_work();
+      }
+      double inflate_seconds = 0;
+      double io_seconds = 0;
+      try {
+        // write the ROM within the limit of outstanding writes
+        auto write = [&]() {
+          controller.begin_io();
+          Clock::time_point write_start = Clock::now();
+          try {
+            write_rom(job.output_filename, rom.data(), rom.size(), options_.output_mode, write_thread_count);
+          }
+          catch (...) {
+            controller.end_io();
+            throw;
+          }
+          controller.end_io();
+          io_seconds += seconds_since(write_start);
+        };
+
+        Clock::time_point inflate_start = Clock::now();
+
+        // a file without psflibs has nothing to be shared
+        if (lib_set.lib_programs.empty()) {
+          rom.assign(static_cast<size_t>(program.load_offset) + program.load_size, 0);
+          inflate_program(program, rom.data() + program.load_offset);
+          inflate_seconds += seconds_since(inflate_start);
+          write();
+          controller.end_work(inflate_seconds, io_seconds, rom.size());
+          continue;
+        }
+
+        // compose the psflibs once for each chunk
+        if (!composed) {
+          rom.assign(get_rom_size(lib_set.lib_programs), 0);
+          for (const PSFProgram & lib_program : lib_set.lib_programs) {
+            cache.load(lib_program, rom.data() + lib_program.load_offset);
+          }
+          composed = true;
+        }
+
+        // apply the program, and save the overwritten bytes
+        char * patch = rom.data() + program.load_offset;
+        undo.assign(patch, patch + program.load_size);
+        try {
+          inflate_program(program, patch);
+          inflate_seconds += seconds_since(inflate_start);
+          write();
+        }
+        catch (...) {
+          memcpy(patch, undo.data(), undo.size());
+          throw;
+        }
+
+        // revert the program for the next file
+        memcpy(patch, undo.data(), undo.size());
+        controller.end_work(inflate_seconds, io_seconds, rom.size());
+      }
+      catch (std::exception & ex) {
+        controller.end_work(inflate_seconds, io_seconds, 0);
+        report_error(ex);
+      }
+    }
+
+    for (const PSFProgram & lib_program : lib_set.lib_programs) {
+      caches_[chunk.node]->release_dependents(lib_program.filename, chunk.end - chunk.begin);
+    }
+  };
+
+  // each thread converts the chunks of its node first, then takes over the
+  // chunks of the other nodes, composing them from the cache of its own node
+  std::unique_ptr<std::atomic<size_t>[]> next_chunks(new std::atomic<size_t>[node_count]);
+  for (size_t node = 0; node < node_count; node++) {
+    next_chunks[node] = 0;
+  }
+  auto worker = [&](size_t node) {
+    if (options_.numa) {
+      bind_current_thread(nodes_[node].cpus);
+    }
+
+    for (size_t i = 0; i < node_count; i++) {
+      size_t queue = (node + i) % node_count;
+      size_t index;
+      while ((index = next_chunks[queue]++) < node_chunks[queue].size()) {
+        convert_chunk(chunks[node_chunks[queue][index]], *caches_[node]);
+      }
+    }
+  };
+
+  if (max_workers == 1 && !options_.numa) {
+    worker(0);
+  }
+  else {
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < max_workers; i++) {
+      threads.emplace_back(worker, i % node_count);
+    }
+    for (std::thread & thread : threads) {
+      thread.join();
+    }
+  }
+
+  concurrency_ = controller.settings();
+  return failures;
+}
+
+/// Returns the metrics of the psflib cache.
+LibCacheStats BatchConverter::cache_stats() const {
+  LibCacheStats stats;
+  for (const auto & cache : caches_) {
+    LibCacheStats node_stats = cache->stats();
+    stats.hits += node_stats.hits;
+    stats.misses += node_stats.misses;
+    stats.evictions += node_stats.evictions;
+    stats.inflated_bytes += node_stats.inflated_bytes;
+    stats.peak_size += node_stats.peak_size;
+    stats.shared_pages += node_stats.shared_pages;
+  }
+  return stats;
+}
+
+/// Returns the concurrency settings of the last run.
+ConcurrencySettings BatchConverter::concurrency() const {
+  return concurrency_;
+}
@@ -0,0 +1,119 @@
+/// @file
+/// BatchConverter class header.
+
+#ifndef BATCH_CONVERTER_HPP_
+#define BATCH_CONVERTER_HPP_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "concurrency_controller.hpp"
+#include "lib_cache.hpp"
+#include "numa.hpp"
+#include "rom_writer.hpp"
+
+/// The number of files in a chunk of a set, which is the unit of work of
+/// each thread.
+constexpr size_t kBatchChunkSize = 16;
+
+/// The BatchOptions struct represents the options of BatchConverter.
+struct BatchOptions {
+  /// The format of the output ROM files.
+  RomOutputMode output_mode = RomOutputMode::kRaw;
+
+  /// The maximum number of bytes held by the psflib cache.
+  size_t cache_capacity = kLibCacheDefaultCapacity;
+
+  /// How the psflib cache holds psflib images.
+  LibCacheStorage cache_storage = LibCacheStorage::kRaw;
+
+  /// The number of worker threads, 0 to choose it automatically.
+  unsigned int thread_count = 1;
+
+  /// True to bind the threads to NUMA nodes, with a psflib cache for each node.
+  bool numa = false;
+
+  /// True to drop the input files (not psflibs) from the page cache once
+  /// they are converted.
+  bool drop_input_cache = false;
+
+  /// True to report the error of each file to the standard output, false
+  /// to count the failures only.
+  bool report_errors = true;
+};
+
+/// The BatchConverter class converts a set of 2SF files to NDS ROM files.
+///
+/// The ROM image of psflibs is composed once for each set of files sharing
+/// the same psflibs. The program of each file is applied over the image in
+/// place, and the overwritten bytes are restored after the output is written.
+/// Therefore, the cost of each file is proportional to the size of its own
+/// program instead of the ROM size.
+///
+/// With multiple threads, each set is split into chunks of kBatchChunkSize
+/// files, and each thread composes its own image for the chunk it converts.
+/// In the automatic mode, the number of active threads and outstanding
+/// writes is adjusted by ConcurrencyController during the run. A thread
+/// waiting to become active releases its image, which is composed again
+/// from the psflib cache when it resumes. The files are read and resolved
+/// before the conversion by a fixed number of threads, which is not adjusted.
+///
+/// With the numa option, the threads are spread over the NUMA nodes and
+/// bound to their CPUs, and each node has its own psflib cache within an
+/// equal share of the capacity. Each set is assigned to a node, and a thread
+/// which runs out of the chunks of its node takes over the chunks of another
+/// node, replicating the psflibs into the cache of its own node.
+class BatchConverter {
+public:
+  /// Constructs a new BatchConverter.
+  /// @param options the options of conversion.
+  explicit BatchConverter(const BatchOptions & options = BatchOptions());
+
+  /// Adds a file to be converted.
+  /// @param filename the path to 2sf file.
+  /// @param output_filename the path to the output ROM file.
+  void add(const std::string & filename, const std::string & output_filename);
+
+  /// Converts all added files.
+  /// @return the number of files which failed to be converted.
+  ///
+  /// @remarks Errors are reported to the standard output for each file,
+  /// unless disabled by the options.
+  int run();
+
+  /// Returns the metrics of the psflib cache.
+  /// @return the metrics of the psflib cache.
+  LibCacheStats cache_stats() const;
+
+  /// Returns the concurrency settings of the last run.
+  /// @return the concurrency settings of the last run.
+  ConcurrencySettings concurrency() const;
+
+private:
+  /// The Job struct represents a file to be converted.
+  struct Job {
+    /// The path to 2sf file.
+    std::string filename;
+
+    /// The path to the output ROM file.
+    std::string output_filename;
+  };
+
+  /// The options of conversion.
+  BatchOptions options_;
+
+  /// Files to be converted.
+  std::vector<Job> jobs_;
+
+  /// The NUMA nodes, or a single node without the numa option.
+  std::vector<NumaNode> nodes_;
+
+  /// The caches of decompressed psflibs for each node, shared among the sets.
+  std::vector<std::unique_ptr<LibCache>> caches_;
+
+  /// The concurrency settings of the last run.
+  ConcurrencySettings concurrency_;
+};
+
+#endif // !BATCH_CONVERTER_HPP_
@@ -0,0 +1,372 @@
+/// @file
+/// Benchmark class implementation.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "batch_converter.hpp"
+#include "benchmark.hpp"
+#include "lib_cache.hpp"
+#include "parallel.hpp"
+#include "rom_writer.hpp"
+#include "cpath.h"
+
+namespace {
+
+/// The two-sided 97.5% quantiles of Student's t-distribution by degrees of
+/// freedom from 1 to 30.
+constexpr double kStudentT975[] = {
+  12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+  2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+  2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+/// Returns true if the file is a 2SF file which is not a psflib.
+/// @param filename the name of the file.
+/// @return true if the file is a 2SF or mini2SF file.
+bool is_2sf_filename(const std::string & filename) {
+  std::string extension = path_findext(filename.c_str());
+  std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) {
+    return static_cast<char>(tolower(static_cast<unsigned char>(c)));
+  });
+  return extension == ".2sf" || extension == ".mini2sf";
+}
+
+/// Finds 2SF files in a directory recursively.
+/// @param directory the path to the directory.
+/// @param filenames the paths to be appended.
+void find_2sf_files(const std::string & directory, std::vector<std::string> & filenames) {
+  std::vector<std::string> names;
+  std::vector<std::string> subdirectories;
+
+#ifdef _WIN32
+  WIN32_FIND_DATAA find_data;
+  HANDLE find = FindFirstFileA((directory + PATH_SEPARATOR_STR + "*").c_str(), &find_data);
+  if (find == INVALID_HANDLE_VALUE) {
+    std::ostringstream message_buffer;
+    message_buffer << directory << ": " << "Unable to open the directory.";
+    throw std::runtime_error(message_buffer.str());
+  }
+  do {
+    std::string name(find_data.cFileName);
+    if (name == "." || name == "..") {
+      continue;
+    }
+    if ((find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
+      subdirectories.push_back(name);
+    }
+    else {
+      names.push_back(name);
+    }
+  } while (FindNextFileA(find, &find_data));
+  FindClose(find);
+#else
+  DIR * dir = opendir(directory.c_str());
+  if (dir == NULL) {
+    std::ostringstream message_buffer;
+    message_buffer << directory << ": " << "Unable to open the directory.";
+    throw std::runtime_error(message_buffer.str());
+  }
+  struct dirent * entry;
+  while ((entry = readdir(dir)) != NULL) {
+    std::string name(entry->d_name);
+    if (name == "." || name == "..") {
+      continue;
+    }
+    if (path_isdir((directory + PATH_SEPARATOR_STR + name).c_str())) {
+      subdirectories.push_back(name);
+    }
+    else {
+      names.push_back(name);
+    }
+  }
+  closedir(dir);
+#endif
+
+  // keep the order stable, so that the sets are the same in every run
+  std::sort(names.begin(), names.end());
+  std::sort(subdirectories.begin(), subdirectories.end());
+  for (const std::string & name : names) {
+    if (is_2sf_filename(name)) {
+      filenames.push_back(directory + PATH_SEPARATOR_STR + name);
+    }
+  }
+  for (const std::string & name : subdirectories) {
+    find_2sf_files(directory + PATH_SEPARATOR_STR + name, filenames);
+  }
+}
+
+/// Returns the temporary directory.
+/// @return the path to the temporary directory.
+std::string get_temporary_directory() {
+#ifdef _WIN32
+  char path[MAX_PATH + 1];
+  DWORD length = GetTempPathA(sizeof(path), path);
+  if (length != 0 && length < sizeof(path)) {
+    return std::string(path, length);
+  }
+  return ".";
+#else
+  const char * path = getenv("TMPDIR");
+  return (path != NULL && path[0] != '\0') ? path : "/tmp";
+#endif
+}
+
+/// The PrivateDirectory class creates a directory which only the current
+/// user can access, under a name which cannot be predicted, and removes it
+/// when destroyed.
+class PrivateDirectory {
+public:
+  /// Creates a private directory.
+  /// @param parent the path to the directory to create it in.
+  explicit PrivateDirectory(const std::string & parent) {
+#ifdef _WIN32
+    // CreateDirectory fails on an existing name, so retry with another name
+    for (unsigned int attempt = 0; attempt < 100; attempt++) {
+      std::ostringstream path_buffer;
+      path_buffer << parent << PATH_SEPARATOR_STR << "2sf2rom-bench-" << GetCurrentProcessId() << "-"
+        << GetTickCount() << "-" << attempt;
+      if (CreateDirectoryA(path_buffer.str().c_str(), NULL)) {
+        path_ = path_buffer.str();
+        return;
+      }
+    }
+#else
+    std::string path_template = parent + PATH_SEPARATOR_STR + "2sf2rom-bench-XXXXXX";
+    std::vector<char> path(path_template.begin(), path_template.end());
+    path.push_back('\0');
+    if (mkdtemp(path.data()) != NULL) {
+      path_ = path.data();
+      return;
+    }
+#endif
+
+    std::ostringstream message_buffer;
+    message_buffer << parent << ": " << "Unable to create a scratch directory.";
+    throw std::runtime_error(message_buffer.str());
+  }
+
+  PrivateDirectory(const PrivateDirectory &) = delete;
+  PrivateDirectory & operator=(const PrivateDirectory &) = delete;
+
+  /// Removes the directory, which must be empty.
+  ~PrivateDirectory() {
+#ifdef _WIN32
+    RemoveDirectoryA(path_.c_str());
+#else
+    rmdir(path_.c_str());
+#endif
+  }
+
+  /// Returns the path to the directory.
+  /// @return the path to the directory.
+  const std::string & path() const {
+    return path_;
+  }
+
+private:
+  /// The path to the directory.
+  std::string path_;
+};
+
+/// Returns the name of an output format.
+/// @param mode the output format.
+/// @return the name of the format.
+const char * get_output_mode_name(RomOutputMode mode) {
+  switch (mode) {
+  case RomOutputMode::kNull:
+    return "none";
+
+  case RomOutputMode::kChunkedGzip:
+    return "gzip";
+
+  case RomOutputMode::kParallelRaw:
+    return "parallel";
+
+  case RomOutputMode::kDirectRaw:
+    return "direct";
+
+  default:
+    return "raw";
+  }
+}
+
+} // namespace
+
+/// Constructs a new Benchmark.
+Benchmark::Benchmark(const BenchmarkOptions & options) :
+    options_(options) {
+  if (options_.scratch_directory.empty()) {
+    options_.scratch_directory = get_temporary_directory();
+  }
+}
+
+/// Adds the 2SF files found in a directory recursively.
+size_t Benchmark::add_directory(const std::string & directory) {
+  size_t count = filenames_.size();
+  find_2sf_files(directory, filenames_);
+  return filenames_.size() - count;
+}
+
+/// Runs all configurations.
+std::vector<BenchmarkResult> Benchmark::run() {
+  std::vector<unsigned int> thread_counts{ 1 };
+  if (get_default_thread_count() > 1) {
+    thread_counts.push_back(get_default_thread_count());
+  }
+  thread_counts.push_back(0);
+
+  // the outputs are written to a private directory, so that no other user
+  // can create files (or symbolic links) under their names in advance
+  PrivateDirectory output_directory(options_.scratch_directory);
+  output_directory_ = output_directory.path();
+
+  std::vector<BenchmarkResult> results;
+  for (unsigned int thread_count : thread_counts) {
+    for (bool cache : { true, false }) {
+      for (RomOutputMode output_mode : { RomOutputMode::kNull, RomOutputMode::kRaw, RomOutputMode::kChunkedGzip,
+          RomOutputMode::kParallelRaw, RomOutputMode::kDirectRaw }) {
+        BenchmarkResult result;
+        result.thread_count = thread_count;
+        result.cache = cache;
+        result.output_mode = output_mode;
+        result.failures = 0;
+
+        std::cout << "Running: threads=" << (thread_count != 0 ? std::to_string(thread_count) : "auto")
+          << " cache=" << (cache ? "on" : "off") << " output=" << get_output_mode_name(output_mode) << std::endl;
+
+        // the files failing in any run are reported once for the configuration
+        int failures;
+        for (unsigned int i = 0; i < options_.warmup; i++) {
+          convert(thread_count, cache, output_mode, failures);
+          result.failures = std::max(result.failures, failures);
+        }
+
+        std::vector<double> times;
+        for (unsigned int i = 0; i < options_.repeat; i++) {
+          times.push_back(convert(thread_count, cache, output_mode, failures));
+          result.failures = std::max(result.failures, failures);
+        }
+        if (result.failures != 0) {
+          std::cout << "  " << result.failures << " of " << filenames_.size() << " files failed to convert."
+            << std::endl;
+        }
+
+        // the confidence interval of the mean by Student's t-distribution
+        double sum = 0;
+        for (double time : times) {
+          sum += time;
+        }
+        result.mean = times.empty() ? 0 : sum / times.size();
+        result.confidence = 0;
+        if (times.size() >= 2) {
+          double squared_deviation = 0;
+          for (double time : times) {
+            squared_deviation += (time - result.mean) * (time - result.mean);
+          }
+          size_t degrees_of_freedom = times.size() - 1;
+          double t = (degrees_of_freedom <= 30) ? kStudentT975[degrees_of_freedom - 1] : 1.960;
+          result.confidence = t * sqrt(squared_deviation / degrees_of_freedom) / sqrt(static_cast<double>(times.size()));
+        }
+        results.push_back(result);
+      }
+    }
+  }
+  return results;
+}
+
+/// Prints the results as a table.
+void Benchmark::print(const std::vector<BenchmarkResult> & results) const {
+  // mark the fastest configuration of each output format
+  auto is_fastest = [&results](const BenchmarkResult & result) {
+    for (const BenchmarkResult & other : results) {
+      if (other.output_mode == result.output_mode && other.mean < result.mean) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  std::cout << filenames_.size() << " files, " << options_.warmup << " warmup, "
+    << options_.repeat << " runs, mean +/- 95% CI (* fastest for each output)" << std::endl;
+  std::cout << std::endl;
+  std::cout << "| Threads | Cache | Output   | Time (s)            | Files/s    |" << std::endl;
+  std::cout << "|---------|-------|----------|---------------------|------------|" << std::endl;
+  for (const BenchmarkResult & result : results) {
+    std::ostringstream time_buffer;
+    time_buffer << std::fixed << std::setprecision(3) << result.mean << " +/- " << result.confidence;
+    if (is_fastest(result)) {
+      time_buffer << " *";
+    }
+
+    double files_per_second = (result.mean > 0) ? filenames_.size() / result.mean : 0;
+    std::cout << "| " << std::left << std::setw(7) << (result.thread_count != 0 ? std::to_string(result.thread_count) : "auto")
+      << " | " << std::setw(5) << (result.cache ? "on" : "off")
+      << " | " << std::setw(8) << get_output_mode_name(result.output_mode)
+      << " | " << std::setw(19) << time_buffer.str()
+      << " | " << std::right << std::setw(10) << std::fixed << std::setprecision(1) << files_per_second
+      << " |" << std::endl;
+    if (result.failures != 0) {
+      std::cout << "  (" << result.failures << " failures)" << std::endl;
+    }
+  }
+}
+
+/// Converts all files once.
+double Benchmark::convert(unsigned int thread_count, bool cache, RomOutputMode output_mode, int & failures) {
+  BatchOptions batch_options;
+  batch_options.thread_count = thread_count;
+  batch_options.cache_capacity = cache ? kLibCacheDefaultCapacity : 0;
+  batch_options.output_mode = output_mode;
+  batch_options.report_errors = false;
+
+  // as --direct-io does, also drop the inputs from the page cache
+  batch_options.drop_input_cache = (output_mode == RomOutputMode::kDirectRaw);
+
+  // the outputs are written to the private directory, one file for each input
+  std::vector<std::string> output_filenames;
+  BatchConverter converter(batch_options);
+  for (size_t i = 0; i < filenames_.size(); i++) {
+    std::ostringstream output_filename_buffer;
+    output_filename_buffer << output_directory_ << PATH_SEPARATOR_STR << i << ".bin";
+    if (output_mode == RomOutputMode::kChunkedGzip) {
+      output_filename_buffer << ".gz";
+    }
+    output_filenames.push_back(output_filename_buffer.str());
+    converter.add(filenames_[i], output_filenames.back());
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  failures = converter.run();
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  if (output_mode != RomOutputMode::kNull) {
+    for (const std::string & output_filename : output_filenames) {
+      remove(output_filename.c_str());
+      if (output_mode == RomOutputMode::kChunkedGzip) {
+        remove((output_filename + ".gzi").c_str());
+      }
+    }
+  }
+  return elapsed;
+}
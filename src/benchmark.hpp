@@ -0,0 +1,97 @@
+/// @file
+/// Benchmark class header.
+
+#ifndef BENCHMARK_HPP_
+#define BENCHMARK_HPP_
+
+#include <string>
+#include <vector>
+
+#include "rom_writer.hpp"
+
+/// The BenchmarkOptions struct represents the options of Benchmark.
+struct BenchmarkOptions {
+  /// The number of runs discarded before measurement.
+  unsigned int warmup = 1;
+
+  /// The number of measured runs.
+  unsigned int repeat = 5;
+
+  /// The directory in which a private directory receiving the output files
+  /// is created, the temporary directory if empty. The outputs are removed
+  /// after each run, and the private directory after all runs.
+  std::string scratch_directory;
+};
+
+/// The BenchmarkResult struct represents the result of a configuration.
+struct BenchmarkResult {
+  /// The number of worker threads, 0 for the automatic mode.
+  unsigned int thread_count;
+
+  /// True if the psflib cache is enabled.
+  bool cache;
+
+  /// The format of the output files.
+  RomOutputMode output_mode;
+
+  /// The mean of the elapsed times in seconds.
+  double mean;
+
+  /// The half width of the 95% confidence interval of the mean in seconds.
+  double confidence;
+
+  /// The number of files failed to be converted in a run.
+  int failures;
+};
+
+/// The Benchmark class measures batch conversion of a corpus of 2SF files
+/// over a matrix of options.
+///
+/// The matrix consists of the number of threads (1, the hardware threads and
+/// the automatic mode), the psflib cache (enabled or disabled) and the
+/// output format (none, raw, chunked gzip, parallel raw and direct raw).
+/// Each configuration is run the warmup times, then the repeat times to
+/// compute the mean and its 95% confidence interval by Student's
+/// t-distribution. The errors of files are not reported in each run, but
+/// counted once for each configuration.
+class Benchmark {
+public:
+  /// Constructs a new Benchmark.
+  /// @param options the options of the benchmark.
+  explicit Benchmark(const BenchmarkOptions & options = BenchmarkOptions());
+
+  /// Adds the 2SF files found in a directory recursively.
+  /// @param directory the path to the directory.
+  /// @return the number of files found.
+  size_t add_directory(const std::string & directory);
+
+  /// Runs all configurations.
+  /// @return the results of the configurations.
+  ///
+  /// @remarks The progress is reported to the standard output.
+  std::vector<BenchmarkResult> run();
+
+  /// Prints the results as a table.
+  /// @param results the results of run().
+  void print(const std::vector<BenchmarkResult> & results) const;
+
+private:
+  /// Converts all files once.
+  /// @param thread_count the number of worker threads, 0 for the automatic mode.
+  /// @param cache true to enable the psflib cache.
+  /// @param output_mode the format of the output files.
+  /// @param failures the number of files failed to be converted.
+  /// @return the elapsed time in seconds.
+  double convert(unsigned int thread_count, bool cache, RomOutputMode output_mode, int & failures);
+
+  /// The options of the benchmark.
+  BenchmarkOptions options_;
+
+  /// The files to be converted.
+  std::vector<std::string> filenames_;
+
+  /// The private directory receiving the output files during run().
+  std::string output_directory_;
+};
+
+#endif // !BENCHMARK_HPP_
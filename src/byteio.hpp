@@ -44,6 +44,13 @@ OutputIterator WriteInt32L(OutputIterator out, uint32_t value) {
   return out;
 }
 
+template <typename OutputIterator>
+OutputIterator WriteInt64L(OutputIterator out, uint64_t value) {
+  out = WriteInt32L(out, static_cast<uint32_t>(value & 0xffffffff));
+  out = WriteInt32L(out, static_cast<uint32_t>(value >> 32));
+  return out;
+}
+
 template <typename Insertable>
 void InsertInt8(Insertable & out, uint8_t value) {
   out << static_cast<char>(value);
@@ -63,6 +70,12 @@ void InsertInt32L(Insertable & out, uint32_t value) {
   out << static_cast<char>((value >> 24) & 0xff);
 }
 
+template <typename Insertable>
+void InsertInt64L(Insertable & out, uint64_t value) {
+  InsertInt32L(out, static_cast<uint32_t>(value & 0xffffffff));
+  InsertInt32L(out, static_cast<uint32_t>(value >> 32));
+}
+
 template <typename InputIterator, typename Int8>
 InputIterator ReadInt8(InputIterator in, Int8 & out) {
   static_assert(sizeof(*in) == 1, "Element size of InputIterator must be 1.");
@@ -106,6 +119,19 @@ InputIterator ReadInt32L(InputIterator in, Int32 & out) {
   return in;
 }
 
+template <typename InputIterator, typename Int64>
+InputIterator ReadInt64L(InputIterator in, Int64 & out) {
+  static_assert(sizeof(Int64) >= 8, "The size of output integer must be 8 at least.");
+
+  uint32_t low;
+  uint32_t high;
+  in = ReadInt32L(in, low);
+  in = ReadInt32L(in, high);
+
+  out = (static_cast<uint64_t>(high) << 32) | low;
+  return in;
+}
+
 template <typename Readable, typename Int8>
 bool ReadStreamAsInt8(Readable & in, Int8 & out) {
   uint8_t data[1];
@@ -0,0 +1,143 @@
+/// @file
+/// ConcurrencyController class implementation.
+
+#include <stdint.h>
+#include <math.h>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+#include "concurrency_controller.hpp"
+#include "parallel.hpp"
+
+namespace {
+
+/// The minimum number of work items in a measurement window.
+constexpr unsigned int kMinWindowItems = 8;
+
+/// The relative drop of throughput which turns the adjustment back.
+constexpr double kThroughputTolerance = 0.05;
+
+} // namespace
+
+/// Constructs a new ConcurrencyController.
+ConcurrencyController::ConcurrencyController(unsigned int max_workers, bool adaptive) :
+    max_workers_(std::max(max_workers, 1u)),
+    adaptive_(adaptive),
+    active_workers_(0),
+    active_io_(0),
+    direction_(1),
+    last_throughput_(0),
+    window_start_(std::chrono::steady_clock::now()),
+    window_items_(0),
+    window_bytes_(0),
+    window_io_seconds_(0),
+    window_inflate_seconds_(0) {
+  // start from the number of hardware threads, which suits CPU-bound runs
+  settings_.workers = adaptive_ ? std::min(max_workers_, get_default_thread_count()) : max_workers_;
+  settings_.outstanding_io = settings_.workers;
+}
+
+/// Waits until a worker is allowed to run.
+void ConcurrencyController::begin_work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  condition_.wait(lock, [this]() { return active_workers_ < settings_.workers; });
+  active_workers_++;
+}
+
+/// Starts a work item of a worker if it is allowed to run without waiting.
+bool ConcurrencyController::try_begin_work() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (active_workers_ >= settings_.workers) {
+    return false;
+  }
+  active_workers_++;
+  return true;
+}
+
+/// Finishes a work item of a worker.
+void ConcurrencyController::end_work(double inflate_seconds, double io_seconds, uint64_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    active_workers_--;
+    settings_.inflate_seconds += inflate_seconds;
+    settings_.io_seconds += io_seconds;
+
+    window_items_++;
+    window_bytes_ += bytes;
+    window_inflate_seconds_ += inflate_seconds;
+    window_io_seconds_ += io_seconds;
+    if (adaptive_ && window_items_ >= std::max(kMinWindowItems, settings_.workers * 2)) {
+      adjust();
+    }
+  }
+  condition_.notify_all();
+}
+
+/// Waits until a write is allowed to be outstanding.
+void ConcurrencyController::begin_io() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  condition_.wait(lock, [this]() { return active_io_ < settings_.outstanding_io; });
+  active_io_++;
+}
+
+/// Finishes an outstanding write.
+void ConcurrencyController::end_io() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    active_io_--;
+  }
+  condition_.notify_all();
+}
+
+/// Adds time spent outside of work items.
+void ConcurrencyController::add_time(double inflate_seconds, double io_seconds) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  settings_.inflate_seconds += inflate_seconds;
+  settings_.io_seconds += io_seconds;
+}
+
+/// Returns the current settings.
+ConcurrencySettings ConcurrencyController::settings() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return settings_;
+}
+
+/// Adjusts the limits at the end of a window.
+void ConcurrencyController::adjust() {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  double elapsed = std::chrono::duration<double>(now - window_start_).count();
+  double throughput = (elapsed > 0) ? window_bytes_ / elapsed : 0;
+
+  // turn back if the last move made it slower, or at the bounds
+  if (throughput < last_throughput_ * (1 - kThroughputTolerance)) {
+    direction_ = -direction_;
+  }
+  if ((direction_ > 0 && settings_.workers >= max_workers_) ||
+      (direction_ < 0 && settings_.workers <= 1)) {
+    direction_ = -direction_;
+  }
+
+  unsigned int step = std::max(settings_.workers / 4, 1u);
+  if (direction_ > 0) {
+    settings_.workers = std::min(settings_.workers + step, max_workers_);
+  }
+  else {
+    settings_.workers = (settings_.workers > step) ? settings_.workers - step : 1;
+  }
+
+  // allow as many writes as the workers are expected to be blocked on,
+  // plus one to keep the storage busy
+  double busy_seconds = window_io_seconds_ + window_inflate_seconds_;
+  double io_share = (busy_seconds > 0) ? window_io_seconds_ / busy_seconds : 1;
+  unsigned int outstanding_io = static_cast<unsigned int>(ceil(settings_.workers * io_share)) + 1;
+  settings_.outstanding_io = std::min(outstanding_io, settings_.workers);
+
+  last_throughput_ = throughput;
+  window_start_ = now;
+  window_items_ = 0;
+  window_bytes_ = 0;
+  window_io_seconds_ = 0;
+  window_inflate_seconds_ = 0;
+}
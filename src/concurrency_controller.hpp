@@ -0,0 +1,123 @@
+/// @file
+/// ConcurrencyController class header.
+
+#ifndef CONCURRENCY_CONTROLLER_HPP_
+#define CONCURRENCY_CONTROLLER_HPP_
+
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+/// The ConcurrencySettings struct represents the settings and the measured
+/// utilisation of ConcurrencyController.
+struct ConcurrencySettings {
+  /// The number of workers allowed to run at once.
+  unsigned int workers = 1;
+
+  /// The number of writes allowed to be outstanding at once.
+  unsigned int outstanding_io = 1;
+
+  /// The total time spent on reading and writing, in seconds.
+  double io_seconds = 0;
+
+  /// The total time spent on decompression, in seconds.
+  double inflate_seconds = 0;
+};
+
+/// The ConcurrencyController class limits the number of active workers and
+/// outstanding writes, and optionally adjusts the limits to the measured
+/// throughput.
+///
+/// In the adaptive mode, the throughput is measured over a window of work
+/// items, and the worker limit is moved by hill climbing: it keeps moving in
+/// the same direction while the throughput improves, and turns back when the
+/// throughput drops. The limit of outstanding writes follows the share of
+/// time blocked on I/O, so that CPU-bound runs do not flood the storage with
+/// writes while I/O-bound runs keep enough writes in flight.
+class ConcurrencyController {
+public:
+  /// Constructs a new ConcurrencyController.
+  /// @param max_workers the maximum number of workers.
+  /// @param adaptive true to adjust the limits to the measured throughput,
+  /// false to allow max_workers at once.
+  ConcurrencyController(unsigned int max_workers, bool adaptive);
+
+  /// Waits until a worker is allowed to run.
+  void begin_work();
+
+  /// Starts a work item of a worker if it is allowed to run without waiting.
+  /// @return true if the work item has been started, false if the worker
+  /// has to wait by begin_work.
+  bool try_begin_work();
+
+  /// Finishes a work item of a worker.
+  /// @param inflate_seconds the time spent on decompression.
+  /// @param io_seconds the time spent on I/O.
+  /// @param bytes the number of bytes produced.
+  void end_work(double inflate_seconds, double io_seconds, uint64_t bytes);
+
+  /// Waits until a write is allowed to be outstanding.
+  void begin_io();
+
+  /// Finishes an outstanding write.
+  void end_io();
+
+  /// Adds time spent outside of work items.
+  /// @param inflate_seconds the time spent on decompression.
+  /// @param io_seconds the time spent on I/O.
+  void add_time(double inflate_seconds, double io_seconds);
+
+  /// Returns the current settings.
+  /// @return the current settings.
+  ConcurrencySettings settings() const;
+
+private:
+  /// Adjusts the limits at the end of a window.
+  void adjust();
+
+  /// The maximum number of workers.
+  unsigned int max_workers_;
+
+  /// True to adjust the limits to the measured throughput.
+  bool adaptive_;
+
+  /// The current settings.
+  ConcurrencySettings settings_;
+
+  /// The number of running workers.
+  unsigned int active_workers_;
+
+  /// The number of outstanding writes.
+  unsigned int active_io_;
+
+  /// The direction of the next adjustment, +1 or -1.
+  int direction_;
+
+  /// The throughput of the previous window, in bytes per second.
+  double last_throughput_;
+
+  /// The start time of the current window.
+  std::chrono::steady_clock::time_point window_start_;
+
+  /// The number of work items finished in the current window.
+  unsigned int window_items_;
+
+  /// The number of bytes produced in the current window.
+  uint64_t window_bytes_;
+
+  /// The time spent on I/O in the current window.
+  double window_io_seconds_;
+
+  /// The time spent on decompression in the current window.
+  double window_inflate_seconds_;
+
+  /// The mutex for all members above.
+  mutable std::mutex mutex_;
+
+  /// Notified when a worker or a write finishes, or the limits change.
+  std::condition_variable condition_;
+};
+
+#endif // !CONCURRENCY_CONTROLLER_HPP_
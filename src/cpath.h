@@ -5,6 +5,7 @@
 #ifndef CPATH_H_INCLUDED
 #define CPATH_H_INCLUDED
 
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
@@ -15,6 +16,7 @@
 #include <shlwapi.h>
 #include <sys/stat.h>
 #include <direct.h>
+#include <io.h>
 #ifndef PATH_MAX
 #define PATH_MAX	_MAX_PATH
 #endif
@@ -138,6 +140,15 @@ static INLINE void path_stripext(char *path)
 #endif
 }
 
+static INLINE bool path_isabs(const char *path)
+{
+#ifdef _WIN32
+	return !PathIsRelativeA(path);
+#else
+	return path[0] == PATH_SEPARATOR_CHAR;
+#endif
+}
+
 static INLINE bool path_isdir(const char *path)
 {
 	struct stat st;
@@ -165,6 +176,23 @@ static off_t path_getfilesize(const char *path)
 	return -1;
 }
 
+static int path_truncate(const char *path, off_t size)
+{
+#ifdef _WIN32
+	int result;
+	FILE *fp = fopen(path, "r+b");
+	if (fp == NULL)
+	{
+		return -1;
+	}
+	result = _chsize(_fileno(fp), size);
+	fclose(fp);
+	return result;
+#else
+	return truncate(path, size);
+#endif
+}
+
 static char *path_getabspath(const char *path, char *absolute_path)
 {
 #ifdef _WIN32
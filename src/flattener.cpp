@@ -0,0 +1,48 @@
+/// @file
+/// 2SF flattener implementation.
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "flattener.hpp"
+#include "program_deflater.hpp"
+#include "psf_file.hpp"
+#include "rom_loader.hpp"
+
+/// Flatten a 2SF file and its psflibs into a single self-contained 2SF file.
+void flatten_2sf(const std::string & filename, const std::string & output_filename, unsigned int thread_count) {
+  std::vector<PSFProgram> programs = resolve_2sf(filename);
+
+  // compose the programs, and find the range covered by them
+  std::vector<char> rom(get_rom_size(programs), 0);
+  uint32_t load_offset = programs.front().load_offset;
+  for (const PSFProgram & program : programs) {
+    inflate_program(program, rom.data() + program.load_offset);
+    load_offset = std::min(load_offset, program.load_offset);
+  }
+
+  // keep the file itself, except the references to psflibs
+  PSFFile psf = std::move(programs.back().psf);
+  for (auto it = psf.tags().begin(); it != psf.tags().end(); ) {
+    const std::string & name = it->first;
+    if (name.compare(0, 4, "_lib") == 0 &&
+        name.find_first_not_of("0123456789", 4) == std::string::npos) {
+      it = psf.tags().erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+
+  uint32_t load_size = static_cast<uint32_t>(rom.size() - load_offset);
+  psf.set_compressed_exe(deflate_program_parallel(load_offset, rom.data() + load_offset, load_size,
+    Z_BEST_COMPRESSION, thread_count));
+  psf.set_compressed_exe_crc32(::crc32(0L, reinterpret_cast<const Bytef *>(psf.compressed_exe().data()),
+    static_cast<uInt>(psf.compressed_exe().size())));
+  psf.write(output_filename);
+}
@@ -0,0 +1,21 @@
+/// @file
+/// 2SF flattener header.
+
+#ifndef FLATTENER_HPP_
+#define FLATTENER_HPP_
+
+#include <string>
+
+/// Flatten a 2SF file and its psflibs into a single self-contained 2SF file.
+/// @param filename the path to 2sf file.
+/// @param output_filename the path to the output 2SF file.
+/// @param thread_count the maximum number of threads compressing the
+/// program, 0 for the default.
+///
+/// @remarks The programs are composed as load_2sf does, and the composed
+/// image from the lowest load offset to the end of the ROM is written as the
+/// single program. The tags of the file are kept except _lib tags.
+void flatten_2sf(const std::string & filename, const std::string & output_filename,
+  unsigned int thread_count = 0);
+
+#endif // !FLATTENER_HPP_
@@ -0,0 +1,279 @@
+/// @file
+/// LazyRomImage class implementation.
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__) && defined(HAVE_LINUX_USERFAULTFD_H)
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+#endif
+
+#include "lazy_rom_image.hpp"
+#include "rom_loader.hpp"
+#include "ZlibReader.h"
+
+namespace {
+
+/// The minimum number of bytes inflated at once for a page fault, so that
+/// sequential access does not restart the decompressor for every page.
+constexpr size_t kLazyInflateStep = 64 * 1024;
+
+/// The size of a page where it cannot be queried.
+constexpr size_t kLazyDefaultPageSize = 4096;
+
+} // namespace
+
+/// Constructs a new LazyRomImage.
+LazyRomImage::LazyRomImage(const std::string & filename) :
+    data_(nullptr),
+    size_(0),
+    mapping_size_(0),
+    page_size_(kLazyDefaultPageSize),
+    uffd_(-1),
+    stop_fd_(-1) {
+  std::vector<PSFProgram> programs = resolve_2sf(filename);
+  size_ = get_rom_size(programs);
+  for (PSFProgram & program : programs) {
+    Layer layer;
+    layer.program = std::move(program);
+    layer.inflated = 0;
+    layer.pending_pages = 0;
+    layer.failed = false;
+    layers_.push_back(std::move(layer));
+  }
+
+#if defined(__linux__) && defined(HAVE_LINUX_USERFAULTFD_H)
+  page_size_ = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  mapping_size_ = (size_ + page_size_ - 1) / page_size_ * page_size_;
+
+  // prefer handling the faults of the kernel too (system calls reading the
+  // image), and fall back to faults from user mode, which unprivileged
+  // processes may handle
+  int uffd = static_cast<int>(syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK));
+#ifdef UFFD_USER_MODE_ONLY
+  if (uffd == -1) {
+    uffd = static_cast<int>(syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY));
+  }
+#endif
+
+  struct uffdio_api api;
+  memset(&api, 0, sizeof(api));
+  api.api = UFFD_API;
+  void * map = MAP_FAILED;
+  if (uffd != -1 && mapping_size_ != 0 && ioctl(uffd, UFFDIO_API, &api) == 0) {
+    map = mmap(NULL, mapping_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+
+  struct uffdio_register range;
+  memset(&range, 0, sizeof(range));
+  range.range.start = reinterpret_cast<uintptr_t>(map);
+  range.range.len = mapping_size_;
+  range.mode = UFFDIO_REGISTER_MODE_MISSING;
+  int stop_fd = -1;
+  if (map != MAP_FAILED && ioctl(uffd, UFFDIO_REGISTER, &range) == 0) {
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+  }
+
+  if (stop_fd != -1) {
+    // the programs stay compressed until their pages are touched
+    for (Layer & layer : layers_) {
+      const std::string & compressed_exe = layer.program.psf.compressed_exe();
+      layer.reader.reset(new ZlibReader(compressed_exe.data(), compressed_exe.size(), false));
+      uint32_t load_offset;
+      uint32_t load_size;
+      layer.reader->readInt(load_offset);
+      layer.reader->readInt(load_size);
+      layer.data.reset(new char[layer.program.load_size]);
+
+      size_t first_page = layer.program.load_offset / page_size_;
+      size_t end_page = (static_cast<size_t>(layer.program.load_offset) + layer.program.load_size + page_size_ - 1) /
+        page_size_;
+      layer.pending_pages = end_page - first_page;
+    }
+    produced_pages_.assign(mapping_size_ / page_size_, false);
+
+    data_ = static_cast<char *>(map);
+    uffd_ = uffd;
+    stop_fd_ = stop_fd;
+    handler_ = std::thread(&LazyRomImage::handle_faults, this);
+    return;
+  }
+
+  // userfaultfd is not available, fall back to the eager image
+  if (map != MAP_FAILED) {
+    munmap(map, mapping_size_);
+  }
+  if (uffd != -1) {
+    close(uffd);
+  }
+  mapping_size_ = 0;
+#endif
+
+  compose();
+}
+
+/// Stops the handler thread and unmaps the image.
+LazyRomImage::~LazyRomImage() {
+#if defined(__linux__) && defined(HAVE_LINUX_USERFAULTFD_H)
+  if (uffd_ != -1) {
+    uint64_t value = 1;
+    if (write(stop_fd_, &value, sizeof(value)) == sizeof(value)) {
+      handler_.join();
+    }
+    else {
+      handler_.detach();
+    }
+    munmap(data_, mapping_size_);
+    close(stop_fd_);
+    close(uffd_);
+  }
+#endif
+}
+
+/// Returns the error which occurred while decompressing a page.
+std::string LazyRomImage::error() const {
+  std::lock_guard<std::mutex> lock(error_mutex_);
+  return error_;
+}
+
+/// Composes the image eagerly.
+void LazyRomImage::compose() {
+  eager_image_.assign(size_, 0);
+  for (const Layer & layer : layers_) {
+    inflate_program(layer.program, eager_image_.data() + layer.program.load_offset);
+  }
+  data_ = eager_image_.data();
+  layers_.clear();
+}
+
+/// Serves the page faults until stopped.
+void LazyRomImage::handle_faults() {
+#if defined(__linux__) && defined(HAVE_LINUX_USERFAULTFD_H)
+  std::unique_ptr<char[]> page(new char[page_size_]);
+  while (true) {
+    struct pollfd fds[2];
+    fds[0].fd = uffd_;
+    fds[0].events = POLLIN;
+    fds[1].fd = stop_fd_;
+    fds[1].events = POLLIN;
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if ((fds[1].revents & POLLIN) != 0) {
+      break;
+    }
+
+    struct uffd_msg message;
+    if (read(uffd_, &message, sizeof(message)) != sizeof(message) ||
+        message.event != UFFD_EVENT_PAGEFAULT) {
+      continue;
+    }
+
+    size_t offset = static_cast<size_t>(message.arg.pagefault.address - reinterpret_cast<uintptr_t>(data_));
+    offset -= offset % page_size_;
+
+    // several threads faulting on the same page report it more than once
+    if (produced_pages_[offset / page_size_]) {
+      struct uffdio_range wake;
+      wake.start = reinterpret_cast<uintptr_t>(data_ + offset);
+      wake.len = page_size_;
+      ioctl(uffd_, UFFDIO_WAKE, &wake);
+      continue;
+    }
+    produced_pages_[offset / page_size_] = true;
+
+    if (produce_page(offset, page.get())) {
+      struct uffdio_copy copy;
+      memset(&copy, 0, sizeof(copy));
+      copy.dst = reinterpret_cast<uintptr_t>(data_ + offset);
+      copy.src = reinterpret_cast<uintptr_t>(page.get());
+      copy.len = page_size_;
+      ioctl(uffd_, UFFDIO_COPY, &copy);
+    }
+    else {
+      struct uffdio_zeropage zeropage;
+      memset(&zeropage, 0, sizeof(zeropage));
+      zeropage.range.start = reinterpret_cast<uintptr_t>(data_ + offset);
+      zeropage.range.len = page_size_;
+      ioctl(uffd_, UFFDIO_ZEROPAGE, &zeropage);
+    }
+  }
+#endif
+}
+
+/// Produces a page of the image.
+bool LazyRomImage::produce_page(size_t offset, char * page) {
+  memset(page, 0, page_size_);
+
+  // the later programs overwrite the earlier ones, as load_2sf does
+  bool covered = false;
+  for (Layer & layer : layers_) {
+    size_t layer_start = layer.program.load_offset;
+    size_t layer_end = layer_start + layer.program.load_size;
+    size_t start = std::max(offset, layer_start);
+    size_t end = std::min(offset + page_size_, layer_end);
+    if (start >= end) {
+      continue;
+    }
+
+    inflate_layer(layer, end - layer_start);
+    end = std::min(end, layer_start + layer.inflated);
+    if (start < end) {
+      memcpy(page + (start - offset), layer.data.get() + (start - layer_start), end - start);
+    }
+    covered = true;
+
+    // every byte of the program is now in the image
+    if (--layer.pending_pages == 0) {
+      layer.data.reset();
+      layer.reader.reset();
+    }
+  }
+  return covered;
+}
+
+/// Inflates a layer up to the given size.
+void LazyRomImage::inflate_layer(Layer & layer, size_t end) {
+  if (layer.failed || layer.inflated >= end) {
+    return;
+  }
+
+  size_t target = std::min(static_cast<size_t>(layer.program.load_size),
+    std::max(end, layer.inflated + kLazyInflateStep));
+  size_t size = target - layer.inflated;
+  int bytes_read = layer.reader->read(layer.data.get() + layer.inflated, size);
+  if (bytes_read > 0) {
+    layer.inflated += static_cast<size_t>(bytes_read);
+  }
+
+  if (bytes_read != static_cast<int>(size)) {
+    layer.failed = true;
+    std::lock_guard<std::mutex> lock(error_mutex_);
+    if (error_.empty()) {
+      error_ = layer.program.filename + ": " + "Failed to deflate data. Program data is corrupted.";
+    }
+  }
+
+  // the decompressor is no longer needed once the program is complete
+  if (layer.failed || layer.inflated == layer.program.load_size) {
+    layer.reader.reset();
+  }
+}
@@ -0,0 +1,148 @@
+/// @file
+/// LazyRomImage class header.
+
+#ifndef LAZY_ROM_IMAGE_HPP_
+#define LAZY_ROM_IMAGE_HPP_
+
+#include <stddef.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rom_loader.hpp"
+#include "ZlibReader.h"
+
+/// The LazyRomImage class represents the ROM image of a 2SF file whose pages
+/// are decompressed on first access.
+///
+/// The image is an anonymous mapping registered with userfaultfd. When a
+/// page is touched for the first time, a handler thread produces just that
+/// page from the programs covering it, and the faulting thread resumes.
+/// zlib streams cannot be entered in the middle, so each program is inflated
+/// forward up to the furthest byte requested so far, and the bytes are kept
+/// for later pages until every page covering the program has been produced.
+///
+/// Where userfaultfd is not available (other platforms, or disallowed for
+/// the process), the image is composed eagerly, so data() always works.
+class LazyRomImage {
+public:
+  /// Constructs a new LazyRomImage.
+  /// @param filename the path to 2sf file.
+  explicit LazyRomImage(const std::string & filename);
+
+  LazyRomImage(const LazyRomImage &) = delete;
+  LazyRomImage & operator=(const LazyRomImage &) = delete;
+
+  /// Stops the handler thread and unmaps the image.
+  ~LazyRomImage();
+
+  /// Returns the ROM image, readable from any thread.
+  /// @return the pointer to the first byte of the image.
+  ///
+  /// @remarks Where only faults from user mode can be handled, system calls
+  /// reading untouched pages (such as write) fail with EFAULT, so the image
+  /// should be copied to a buffer before being passed to the kernel.
+  inline const char * data() const noexcept {
+    return data_;
+  }
+
+  /// Returns the size of the ROM image.
+  /// @return the size in bytes.
+  inline size_t size() const noexcept {
+    return size_;
+  }
+
+  /// Returns true if the pages are decompressed on first access.
+  /// @return false if the image has been composed eagerly.
+  inline bool lazy() const noexcept {
+    return uffd_ != -1;
+  }
+
+  /// Returns the error which occurred while decompressing a page.
+  /// @return the error message, empty if none.
+  ///
+  /// @remarks The bytes of a program which failed to be decompressed read as
+  /// zeros.
+  std::string error() const;
+
+private:
+  /// The Layer struct represents a program inflated forward on demand.
+  struct Layer {
+    /// The program.
+    PSFProgram program;
+
+    /// The decompressor positioned after the inflated bytes.
+    std::unique_ptr<ZlibReader> reader;
+
+    /// The bytes inflated so far, allocated for the whole program, and
+    /// released once all pages covering the program have been produced.
+    std::unique_ptr<char[]> data;
+
+    /// The number of bytes inflated so far.
+    size_t inflated;
+
+    /// The number of pages covering the program not produced yet.
+    size_t pending_pages;
+
+    /// True if the program failed to be decompressed.
+    bool failed;
+  };
+
+  /// Composes the image eagerly.
+  void compose();
+
+  /// Serves the page faults until stopped.
+  void handle_faults();
+
+  /// Produces a page of the image.
+  /// @param offset the offset of the page.
+  /// @param page the page to be filled.
+  /// @return false if the page is not covered by any program.
+  bool produce_page(size_t offset, char * page);
+
+  /// Inflates a layer up to the given size.
+  /// @param layer the layer.
+  /// @param end the number of bytes needed from the start of the program.
+  void inflate_layer(Layer & layer, size_t end);
+
+  /// The programs in the order of loading.
+  std::vector<Layer> layers_;
+
+  /// True for each page which has been produced.
+  std::vector<bool> produced_pages_;
+
+  /// The ROM image.
+  char * data_;
+
+  /// The size of the ROM image.
+  size_t size_;
+
+  /// The size of the mapping, a multiple of the page size.
+  size_t mapping_size_;
+
+  /// The size of a page.
+  size_t page_size_;
+
+  /// The userfaultfd descriptor, -1 if the image is eager.
+  int uffd_;
+
+  /// The eventfd descriptor stopping the handler thread.
+  int stop_fd_;
+
+  /// The handler thread.
+  std::thread handler_;
+
+  /// The image composed eagerly.
+  std::vector<char> eager_image_;
+
+  /// The mutex guarding error_.
+  mutable std::mutex error_mutex_;
+
+  /// The error which occurred while decompressing a page.
+  std::string error_;
+};
+
+#endif // !LAZY_ROM_IMAGE_HPP_
@@ -0,0 +1,169 @@
+/// @file
+/// LibCache class implementation.
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include "lib_cache.hpp"
+#include "lib_image_store.hpp"
+#include "rom_loader.hpp"
+
+/// Constructs a new LibCache.
+LibCache::LibCache(size_t capacity, LibCacheStorage storage) :
+    capacity_(capacity),
+    storage_(storage),
+    clock_(0),
+    image_usage_(0) {
+}
+
+/// Adds pending dependents of a psflib.
+void LibCache::add_dependents(const std::string & filename, size_t count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_[filename].pending += count;
+}
+
+/// Removes pending dependents of a psflib.
+void LibCache::release_dependents(const std::string & filename, size_t count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(filename);
+  if (it != entries_.end()) {
+    Entry & entry = it->second;
+    entry.pending -= std::min(entry.pending, count);
+  }
+}
+
+/// Decompresses a psflib program, or copies it from the cache.
+void LibCache::load(const PSFProgram & program, char * data) {
+  Entry * pinned = nullptr;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Entry & entry = entries_[program.filename];
+    entry.last_use = ++clock_;
+
+    // wait for another thread decompressing the same psflib
+    loaded_.wait(lock, [&entry]() { return !entry.loading; });
+    if (entry.image) {
+      stats_.hits++;
+      entry.readers++;
+      pinned = &entry;
+    }
+    else {
+      stats_.misses++;
+      stats_.inflated_bytes += program.load_size;
+      entry.loading = true;
+    }
+  }
+
+  // copy without the lock, so that the hits of threads run in parallel
+  // (the image is pinned against eviction meanwhile)
+  if (pinned != nullptr) {
+    try {
+      pinned->image->copy_to(data);
+    }
+    catch (...) {
+      unpin(pinned);
+      throw;
+    }
+    unpin(pinned);
+    return;
+  }
+
+  // decompress without the lock, so that other threads can use the cache
+  try {
+    inflate_program(program, data);
+  }
+  catch (...) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      entries_[program.filename].loading = false;
+    }
+    loaded_.notify_all();
+    throw;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry & entry = entries_[program.filename];
+    entry.loading = false;
+
+    // keep the program if it fits in the cache
+    if (program.load_size <= capacity_) {
+      if (entry.image) {
+        image_usage_ -= entry.image->memory_usage();
+      }
+      switch (storage_) {
+      case LibCacheStorage::kDedup:
+        entry.image = store_.add(data, program.load_size);
+        break;
+
+      case LibCacheStorage::kCompressed:
+        entry.image.reset(new CompressedLibImage(data, program.load_size));
+        break;
+
+      default:
+        entry.image.reset(new RawLibImage(data, program.load_size));
+        break;
+      }
+      image_usage_ += entry.image->memory_usage();
+
+      evict(&entry);
+      stats_.peak_size = std::max(stats_.peak_size, memory_usage());
+    }
+  }
+  loaded_.notify_all();
+}
+
+/// Releases an image pinned by load.
+void LibCache::unpin(Entry * entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entry->readers--;
+
+  // evict what could not be evicted while pinned
+  evict(nullptr);
+}
+
+/// Returns the metrics of the cache.
+LibCacheStats LibCache::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  LibCacheStats stats = stats_;
+  stats.shared_pages = store_.shared_pages();
+  return stats;
+}
+
+/// Returns the number of bytes held by the cache.
+size_t LibCache::memory_usage() const {
+  return store_.memory_usage() + image_usage_;
+}
+
+/// Evicts psflibs until the cache fits in the capacity.
+void LibCache::evict(const Entry * keep) {
+  while (memory_usage() > capacity_) {
+    // choose the least pending, then least recently used psflib
+    Entry * victim = nullptr;
+    for (auto & pair : entries_) {
+      Entry & entry = pair.second;
+      if (!entry.image || &entry == keep || entry.readers != 0) {
+        continue;
+      }
+
+      if (victim == nullptr || entry.pending < victim->pending ||
+          (entry.pending == victim->pending && entry.last_use < victim->last_use)) {
+        victim = &entry;
+      }
+    }
+
+    if (victim == nullptr) {
+      break;
+    }
+
+    image_usage_ -= victim->image->memory_usage();
+    victim->image.reset();
+    stats_.evictions++;
+  }
+}
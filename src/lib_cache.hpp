@@ -0,0 +1,155 @@
+/// @file
+/// LibCache class header.
+
+#ifndef LIB_CACHE_HPP_
+#define LIB_CACHE_HPP_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "lib_image_store.hpp"
+#include "rom_loader.hpp"
+
+/// The default capacity of the psflib cache.
+constexpr size_t kLibCacheDefaultCapacity = 256 * 1024 * 1024;
+
+/// The LibCacheStorage enum represents how LibCache holds psflib images.
+enum class LibCacheStorage {
+  /// Raw bytes.
+  kRaw,
+
+  /// Pages shared among psflib images by LibImageStore.
+  kDedup,
+
+  /// Blocks compressed by CompressedLibImage.
+  kCompressed,
+};
+
+/// The LibCacheStats struct represents the metrics of LibCache.
+struct LibCacheStats {
+  /// The number of psflibs found in the cache.
+  uint64_t hits = 0;
+
+  /// The number of psflibs decompressed.
+  uint64_t misses = 0;
+
+  /// The number of psflibs evicted from the cache.
+  uint64_t evictions = 0;
+
+  /// The number of bytes decompressed.
+  uint64_t inflated_bytes = 0;
+
+  /// The peak number of bytes held by the cache.
+  size_t peak_size = 0;
+
+  /// The number of pages shared with other psflibs.
+  uint64_t shared_pages = 0;
+};
+
+/// The LibCache class caches decompressed psflib programs within a capacity.
+///
+/// The cache knows how many queued files still depend on each psflib.
+/// When the capacity is exceeded, psflibs with no pending dependents are
+/// evicted first, then the ones with the least pending dependents,
+/// and the least recently used one among them.
+///
+/// The cache can be shared among threads. Psflibs are decompressed outside
+/// the lock, and threads loading the same psflib wait for the first one.
+/// Images are also copied (or decompressed from the compressed storage)
+/// outside the lock, pinned against eviction meanwhile.
+class LibCache {
+public:
+  /// Constructs a new LibCache.
+  /// @param capacity the maximum number of bytes held by the cache.
+  /// @param storage how the cache holds psflib images.
+  explicit LibCache(size_t capacity = kLibCacheDefaultCapacity,
+    LibCacheStorage storage = LibCacheStorage::kRaw);
+
+  /// Adds pending dependents of a psflib.
+  /// @param filename the absolute path of the psflib.
+  /// @param count the number of dependents.
+  void add_dependents(const std::string & filename, size_t count = 1);
+
+  /// Removes pending dependents of a psflib.
+  /// @param filename the absolute path of the psflib.
+  /// @param count the number of dependents.
+  void release_dependents(const std::string & filename, size_t count = 1);
+
+  /// Decompresses a psflib program, or copies it from the cache.
+  /// @param program the psflib program.
+  /// @param data the buffer of load_size bytes, which is usually the ROM image
+  /// at load_offset.
+  void load(const PSFProgram & program, char * data);
+
+  /// Returns the metrics of the cache.
+  /// @return the metrics of the cache.
+  LibCacheStats stats() const;
+
+private:
+  /// The Entry struct represents a psflib known to the cache.
+  struct Entry {
+    /// The decompressed program, if cached.
+    std::unique_ptr<LibImage> image;
+
+    /// The number of pending dependents.
+    size_t pending = 0;
+
+    /// The time of the last use.
+    uint64_t last_use = 0;
+
+    /// True while a thread is decompressing the program.
+    bool loading = false;
+
+    /// The number of threads copying the image, which is not evicted
+    /// while any.
+    size_t readers = 0;
+  };
+
+  /// Releases an image pinned by load.
+  /// @param entry the psflib whose image has been copied.
+  void unpin(Entry * entry);
+
+  /// Returns the number of bytes held by the cache.
+  /// @return the number of bytes held by the cache.
+  size_t memory_usage() const;
+
+  /// Evicts psflibs until the cache fits in the capacity.
+  /// @param keep the psflib not to be evicted.
+  void evict(const Entry * keep);
+
+  /// The maximum number of bytes held by the cache.
+  size_t capacity_;
+
+  /// How the cache holds psflib images.
+  LibCacheStorage storage_;
+
+  /// The shared pages of psflib images, which must outlive the entries.
+  LibImageStore store_;
+
+  /// The clock for the last use.
+  uint64_t clock_;
+
+  /// The psflibs, keyed by absolute path (never erased, so that pinned
+  /// entries stay valid).
+  std::unordered_map<std::string, Entry> entries_;
+
+  /// The number of bytes held by the images of entries_ themselves, kept
+  /// along with them so that the usage is not summed on every eviction.
+  size_t image_usage_;
+
+  /// The metrics of the cache.
+  LibCacheStats stats_;
+
+  /// The mutex for all members above.
+  mutable std::mutex mutex_;
+
+  /// Notified when a thread finishes decompressing a program.
+  std::condition_variable loaded_;
+};
+
+#endif // !LIB_CACHE_HPP_
@@ -0,0 +1,243 @@
+/// @file
+/// Storage classes of decompressed psflib images.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <zlib.h>
+
+#include "lib_image_store.hpp"
+
+namespace {
+
+/// Computes the 64-bit hash of data.
+/// @param data the data.
+/// @param size the size of the data.
+/// @return the hash of the data.
+uint64_t hash_page(const char * data, size_t size) {
+  constexpr uint64_t kPrime = 0x100000001b3ULL;
+  uint64_t hash = 0xcbf29ce484222325ULL ^ size;
+
+  // mix 8 bytes at once, and the remaining bytes one by one
+  size_t offset = 0;
+  for (; offset + 8 <= size; offset += 8) {
+    uint64_t word;
+    memcpy(&word, data + offset, 8);
+    hash = (hash ^ word) * kPrime;
+    hash ^= hash >> 29;
+  }
+  for (; offset < size; offset++) {
+    hash = (hash ^ static_cast<unsigned char>(data[offset])) * kPrime;
+  }
+  return hash;
+}
+
+} // namespace
+
+/// Constructs a new RawLibImage.
+RawLibImage::RawLibImage(const char * data, size_t size) :
+    data_(data, data + size) {
+}
+
+/// Returns the size of the image.
+size_t RawLibImage::size() const {
+  return data_.size();
+}
+
+/// Returns the number of bytes held by the image itself.
+size_t RawLibImage::memory_usage() const {
+  return data_.size();
+}
+
+/// Copies the image.
+void RawLibImage::copy_to(char * data) const {
+  memcpy(data, data_.data(), data_.size());
+}
+
+/// Constructs a new CompressedLibImage.
+CompressedLibImage::CompressedLibImage(const char * data, size_t size) :
+    size_(size) {
+  z_stream z = {};
+  if (deflateInit2(&z, Z_BEST_SPEED, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw std::runtime_error("Unable to initialize zlib.");
+  }
+
+  std::vector<char> compressed_block(deflateBound(&z, kLibImageBlockSize));
+  for (size_t offset = 0; offset < size; offset += kLibImageBlockSize) {
+    const char * block_data = data + offset;
+    size_t block_size = std::min(kLibImageBlockSize, size - offset);
+
+    Block block;
+    block.offset = data_.size();
+    block.size = 0;
+
+    // elide the block filled with zero
+    if (std::all_of(block_data, block_data + block_size, [](char c) { return c == 0; })) {
+      block.type = BlockType::kZero;
+      blocks_.push_back(block);
+      continue;
+    }
+
+    deflateReset(&z);
+    z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(block_data));
+    z.avail_in = static_cast<uInt>(block_size);
+    z.next_out = reinterpret_cast<Bytef *>(compressed_block.data());
+    z.avail_out = static_cast<uInt>(compressed_block.size());
+    int zresult = deflate(&z, Z_FINISH);
+    size_t compressed_size = compressed_block.size() - z.avail_out;
+
+    if (zresult == Z_STREAM_END && compressed_size < block_size) {
+      block.type = BlockType::kDeflated;
+      block.size = compressed_size;
+      data_.insert(data_.end(), compressed_block.data(), compressed_block.data() + compressed_size);
+    }
+    else {
+      block.type = BlockType::kStored;
+      block.size = block_size;
+      data_.insert(data_.end(), block_data, block_data + block_size);
+    }
+    blocks_.push_back(block);
+  }
+  deflateEnd(&z);
+
+  data_.shrink_to_fit();
+}
+
+/// Returns the size of the image.
+size_t CompressedLibImage::size() const {
+  return size_;
+}
+
+/// Returns the number of bytes held by the image itself.
+size_t CompressedLibImage::memory_usage() const {
+  return data_.size() + blocks_.size() * sizeof(Block);
+}
+
+/// Copies the image.
+void CompressedLibImage::copy_to(char * data) const {
+  z_stream z = {};
+  if (inflateInit2(&z, -15) != Z_OK) {
+    throw std::runtime_error("Unable to initialize zlib.");
+  }
+
+  for (size_t block_index = 0; block_index < blocks_.size(); block_index++) {
+    const Block & block = blocks_[block_index];
+    char * block_data = data + block_index * kLibImageBlockSize;
+    size_t block_size = std::min(kLibImageBlockSize, size_ - block_index * kLibImageBlockSize);
+
+    switch (block.type) {
+    case BlockType::kZero:
+      memset(block_data, 0, block_size);
+      break;
+
+    case BlockType::kStored:
+      memcpy(block_data, &data_[block.offset], block_size);
+      break;
+
+    case BlockType::kDeflated:
+      inflateReset(&z);
+      z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(&data_[block.offset]));
+      z.avail_in = static_cast<uInt>(block.size);
+      z.next_out = reinterpret_cast<Bytef *>(block_data);
+      z.avail_out = static_cast<uInt>(block_size);
+      if (inflate(&z, Z_FINISH) != Z_STREAM_END || z.avail_out != 0) {
+        inflateEnd(&z);
+        throw std::runtime_error("Cached psflib image is corrupted.");
+      }
+      break;
+    }
+  }
+  inflateEnd(&z);
+}
+
+/// Constructs a new LibImageStore.
+LibImageStore::LibImageStore() :
+    memory_usage_(0),
+    shared_pages_(0) {
+}
+
+/// Stores an image.
+std::unique_ptr<LibImage> LibImageStore::add(const char * data, size_t size) {
+  std::unique_ptr<PagedLibImage> image(new PagedLibImage());
+  image->image_size = size;
+  for (size_t offset = 0; offset < size; offset += kLibImagePageSize) {
+    image->pages.push_back(get_page(data + offset, std::min(kLibImagePageSize, size - offset)));
+  }
+  return image;
+}
+
+/// Returns the number of bytes held by the pages.
+size_t LibImageStore::memory_usage() const {
+  return memory_usage_;
+}
+
+/// Returns the number of pages found already stored.
+uint64_t LibImageStore::shared_pages() const {
+  return shared_pages_;
+}
+
+/// Returns a page which has the specified data.
+std::shared_ptr<const LibImageStore::Page> LibImageStore::get_page(const char * data, size_t size) {
+  uint64_t hash = hash_page(data, size);
+
+  // share the stored page if the data is identical
+  auto range = pages_.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    std::shared_ptr<const Page> page = it->second.lock();
+    if (page && page->data.size() == size && memcmp(page->data.data(), data, size) == 0) {
+      shared_pages_++;
+      return page;
+    }
+  }
+
+  Page * new_page = new Page();
+  new_page->hash = hash;
+  new_page->data.assign(data, data + size);
+  std::shared_ptr<const Page> page(new_page, [this](Page * page) { release_page(page); });
+  pages_.emplace(hash, page);
+  memory_usage_ += size;
+  return page;
+}
+
+/// Releases a page which is no longer referred to.
+void LibImageStore::release_page(Page * page) {
+  auto range = pages_.equal_range(page->hash);
+  for (auto it = range.first; it != range.second; ) {
+    if (it->second.expired()) {
+      it = pages_.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+
+  memory_usage_ -= page->data.size();
+  delete page;
+}
+
+/// Returns the size of the image.
+size_t LibImageStore::PagedLibImage::size() const {
+  return image_size;
+}
+
+/// Returns the number of bytes held by the image itself.
+size_t LibImageStore::PagedLibImage::memory_usage() const {
+  // the pages are counted by the store
+  return pages.size() * sizeof(std::shared_ptr<const Page>);
+}
+
+/// Copies the image.
+void LibImageStore::PagedLibImage::copy_to(char * data) const {
+  size_t offset = 0;
+  for (const auto & page : pages) {
+    memcpy(data + offset, page->data.data(), page->data.size());
+    offset += page->data.size();
+  }
+}
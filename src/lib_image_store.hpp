@@ -0,0 +1,177 @@
+/// @file
+/// Storage classes of decompressed psflib images.
+
+#ifndef LIB_IMAGE_STORE_HPP_
+#define LIB_IMAGE_STORE_HPP_
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+/// The size of pages shared among psflib images.
+constexpr size_t kLibImagePageSize = 4096;
+
+/// The size of blocks of compressed psflib images.
+constexpr size_t kLibImageBlockSize = 64 * 1024;
+
+/// The LibImage class represents a decompressed psflib image held in memory.
+class LibImage {
+public:
+  /// Destructs the LibImage.
+  virtual ~LibImage() = default;
+
+  /// Returns the size of the image.
+  /// @return the size of the image.
+  virtual size_t size() const = 0;
+
+  /// Returns the number of bytes held by the image itself.
+  /// @return the number of bytes held by the image itself.
+  virtual size_t memory_usage() const = 0;
+
+  /// Copies the image.
+  /// @param data the buffer of size() bytes.
+  virtual void copy_to(char * data) const = 0;
+};
+
+/// The RawLibImage class holds a psflib image as is.
+class RawLibImage : public LibImage {
+public:
+  /// Constructs a new RawLibImage.
+  /// @param data the image.
+  /// @param size the size of the image.
+  RawLibImage(const char * data, size_t size);
+
+  size_t size() const override;
+  size_t memory_usage() const override;
+  void copy_to(char * data) const override;
+
+private:
+  /// The image.
+  std::vector<char> data_;
+};
+
+/// The CompressedLibImage class holds a psflib image as compressed blocks.
+///
+/// Blocks filled with zero are not stored at all, and other blocks are
+/// compressed by deflate at the fastest level, or stored as is if they do
+/// not shrink. Each block is decompressed directly into the destination.
+class CompressedLibImage : public LibImage {
+public:
+  /// Constructs a new CompressedLibImage.
+  /// @param data the image.
+  /// @param size the size of the image.
+  CompressedLibImage(const char * data, size_t size);
+
+  size_t size() const override;
+  size_t memory_usage() const override;
+  void copy_to(char * data) const override;
+
+private:
+  /// The BlockType enum represents how a block is stored.
+  enum class BlockType : uint8_t {
+    /// Filled with zero.
+    kZero,
+
+    /// Stored as is.
+    kStored,
+
+    /// Compressed by raw deflate.
+    kDeflated,
+  };
+
+  /// The Block struct represents a block of the image.
+  struct Block {
+    /// How the block is stored.
+    BlockType type;
+
+    /// Offset of the block data in data_.
+    size_t offset;
+
+    /// Size of the block data in data_.
+    size_t size;
+  };
+
+  /// The blocks of the image.
+  std::vector<Block> blocks_;
+
+  /// The data of all blocks.
+  std::vector<char> data_;
+
+  /// The size of the image.
+  size_t size_;
+};
+
+/// The LibImageStore class holds psflib images as fixed-size pages, and
+/// shares identical pages among the images.
+///
+/// Pages are read-only and reference-counted. A page is released when no
+/// image refers to it, so the store must outlive its images.
+class LibImageStore {
+public:
+  /// Constructs a new LibImageStore.
+  LibImageStore();
+
+  LibImageStore(const LibImageStore &) = delete;
+  LibImageStore & operator=(const LibImageStore &) = delete;
+
+  /// Stores an image.
+  /// @param data the image.
+  /// @param size the size of the image.
+  /// @return the stored image.
+  std::unique_ptr<LibImage> add(const char * data, size_t size);
+
+  /// Returns the number of bytes held by the pages.
+  /// @return the number of bytes held by the pages.
+  size_t memory_usage() const;
+
+  /// Returns the number of pages found already stored.
+  /// @return the number of pages found already stored.
+  uint64_t shared_pages() const;
+
+private:
+  /// The Page struct represents a page of psflib images.
+  struct Page {
+    /// The hash of the data.
+    uint64_t hash;
+
+    /// The data of the page.
+    std::vector<char> data;
+  };
+
+  /// The PagedLibImage class holds a psflib image as pages of the store.
+  class PagedLibImage : public LibImage {
+  public:
+    size_t size() const override;
+    size_t memory_usage() const override;
+    void copy_to(char * data) const override;
+
+    /// The pages of the image.
+    std::vector<std::shared_ptr<const Page>> pages;
+
+    /// The size of the image.
+    size_t image_size;
+  };
+
+  /// Returns a page which has the specified data.
+  /// @param data the data of the page.
+  /// @param size the size of the page.
+  /// @return the shared page.
+  std::shared_ptr<const Page> get_page(const char * data, size_t size);
+
+  /// Releases a page which is no longer referred to.
+  /// @param page the page.
+  void release_page(Page * page);
+
+  /// The pages, keyed by their hashes.
+  std::unordered_multimap<uint64_t, std::weak_ptr<const Page>> pages_;
+
+  /// The number of bytes held by the pages.
+  size_t memory_usage_;
+
+  /// The number of pages found already stored.
+  uint64_t shared_pages_;
+};
+
+#endif // !LIB_IMAGE_STORE_HPP_
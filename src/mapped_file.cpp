@@ -0,0 +1,139 @@
+/// @file
+/// MappedFile class implementation.
+
+#include <stdint.h>
+
+#include <string>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.hpp"
+
+/// Constructs a new empty MappedFile.
+MappedFile::MappedFile() :
+    data_(nullptr),
+    size_(0)
+#ifdef _WIN32
+    , mapping_(nullptr)
+#endif
+{
+}
+
+/// Maps a file into memory.
+MappedFile::MappedFile(const std::string & filename) :
+    MappedFile() {
+#ifdef _WIN32
+  HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Unable to open the file.";
+    throw std::runtime_error(message_buffer.str());
+  }
+
+  LARGE_INTEGER file_size;
+  GetFileSizeEx(file, &file_size);
+  size_ = static_cast<size_t>(file_size.QuadPart);
+  if (size_ != 0) {
+    mapping_ = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping_ != NULL) {
+      data_ = static_cast<const char *>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    }
+  }
+  CloseHandle(file);
+  if (size_ != 0 && data_ == nullptr) {
+    close();
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Unable to map the file.";
+    throw std::runtime_error(message_buffer.str());
+  }
+#else
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Unable to open the file.";
+    throw std::runtime_error(message_buffer.str());
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size != 0) {
+    void * data = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    if (data != MAP_FAILED) {
+      data_ = static_cast<const char *>(data);
+      size_ = static_cast<size_t>(st.st_size);
+    }
+    else {
+      ::close(fd);
+      std::ostringstream message_buffer;
+      message_buffer << filename << ": " << "Unable to map the file.";
+      throw std::runtime_error(message_buffer.str());
+    }
+  }
+  ::close(fd);
+#endif
+}
+
+/// Acquires the mapping of specified MappedFile.
+MappedFile::MappedFile(MappedFile && origin) :
+    MappedFile() {
+  *this = std::move(origin);
+}
+
+/// Move-assigns the mapping of specified MappedFile.
+MappedFile & MappedFile::operator=(MappedFile && origin) {
+  if (this != &origin) {
+    close();
+    data_ = origin.data_;
+    size_ = origin.size_;
+    origin.data_ = nullptr;
+    origin.size_ = 0;
+#ifdef _WIN32
+    mapping_ = origin.mapping_;
+    origin.mapping_ = nullptr;
+#endif
+  }
+  return *this;
+}
+
+/// Unmaps the file.
+MappedFile::~MappedFile() {
+  close();
+}
+
+/// Returns the mapped data.
+const char * MappedFile::data() const {
+  return data_;
+}
+
+/// Returns the size of the mapped data.
+size_t MappedFile::size() const {
+  return size_;
+}
+
+/// Unmaps the file.
+void MappedFile::close() {
+#ifdef _WIN32
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+  }
+  if (mapping_ != nullptr) {
+    CloseHandle(mapping_);
+    mapping_ = nullptr;
+  }
+#else
+  if (data_ != nullptr) {
+    munmap(const_cast<char *>(data_), size_);
+  }
+#endif
+  data_ = nullptr;
+  size_ = 0;
+}
@@ -0,0 +1,59 @@
+/// @file
+/// MappedFile class header.
+
+#ifndef MAPPED_FILE_HPP_
+#define MAPPED_FILE_HPP_
+
+#include <stdint.h>
+
+#include <string>
+
+/// The MappedFile class represents a read-only memory mapping of a file.
+class MappedFile {
+public:
+  /// Constructs a new empty MappedFile.
+  MappedFile();
+
+  /// Maps a file into memory.
+  /// @param filename path of the file.
+  explicit MappedFile(const std::string & filename);
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile & operator=(const MappedFile &) = delete;
+
+  /// Acquires the mapping of specified MappedFile.
+  /// @param origin a MappedFile object.
+  MappedFile(MappedFile && origin);
+
+  /// Move-assigns the mapping of specified MappedFile.
+  /// @param origin a MappedFile object.
+  MappedFile & operator=(MappedFile && origin);
+
+  /// Unmaps the file.
+  virtual ~MappedFile();
+
+  /// Returns the mapped data.
+  /// @return the mapped data.
+  const char * data() const;
+
+  /// Returns the size of the mapped data.
+  /// @return the size of the mapped data.
+  size_t size() const;
+
+private:
+  /// Unmaps the file.
+  void close();
+
+  /// Mapped data.
+  const char * data_;
+
+  /// Size of the mapped data.
+  size_t size_;
+
+#ifdef _WIN32
+  /// Handle of the file mapping object.
+  void * mapping_;
+#endif
+};
+
+#endif // !MAPPED_FILE_HPP_
@@ -0,0 +1,218 @@
+/// @file
+/// MiniOptimizer class implementation.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include <zlib.h>
+
+#include "mini_optimizer.hpp"
+#include "program_deflater.hpp"
+#include "psf_file.hpp"
+#include "rom_loader.hpp"
+#include "rom_overlay.hpp"
+#include "cpath.h"
+
+namespace {
+
+/// Returns the name of the _libN tag.
+/// @param lib_index the index of psflib, starting from 1.
+/// @return the name of the tag.
+std::string get_lib_tag_name(int lib_index) {
+  std::string lib_tag_name = "_lib";
+  if (lib_index > 1) {
+    lib_tag_name += std::to_string(lib_index);
+  }
+  return lib_tag_name;
+}
+
+/// Sets the compressed program of a PSF file.
+/// @param psf the PSF file.
+/// @param load_offset the offset of the program in the ROM image.
+/// @param data the program.
+/// @param size the size of the program.
+void set_program(PSFFile & psf, uint32_t load_offset, const char * data, size_t size) {
+  psf.set_compressed_exe(deflate_program(load_offset, data, static_cast<uint32_t>(size)));
+  psf.set_compressed_exe_crc32(::crc32(0L, reinterpret_cast<const Bytef *>(psf.compressed_exe().data()),
+    static_cast<uInt>(psf.compressed_exe().size())));
+}
+
+/// Replace a file with a PSF file.
+/// @param psf the PSF file.
+/// @param filename the path to the file to be replaced.
+///
+/// @remarks The file is written to a temporary path, then renamed over the
+/// original, so a failure never leaves it incomplete, and the other hard
+/// links of the original keep their content.
+void replace_psf_file(const PSFFile & psf, const std::string & filename) {
+  std::string temporary_path = filename + ".2sf2rom-tmp";
+  try {
+    psf.write(temporary_path);
+  }
+  catch (...) {
+    remove(temporary_path.c_str());
+    throw;
+  }
+
+#ifdef _WIN32
+  bool replaced = MoveFileExA(temporary_path.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+  int error = replaced ? 0 : EIO;
+#else
+  // keep the permissions of the original
+  struct stat original_stat;
+  if (stat(filename.c_str(), &original_stat) == 0) {
+    chmod(temporary_path.c_str(), original_stat.st_mode & 07777);
+  }
+
+  bool replaced = rename(temporary_path.c_str(), filename.c_str()) == 0;
+  int error = errno;
+#endif
+  if (!replaced) {
+    remove(temporary_path.c_str());
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Unable to replace the file (" << strerror(error) << ").";
+    throw std::runtime_error(message_buffer.str());
+  }
+}
+
+} // namespace
+
+/// Constructs a new MiniOptimizer.
+MiniOptimizer::MiniOptimizer(const MiniOptimizerOptions & options) :
+    options_(options) {
+}
+
+/// Adds a file to be optimized.
+void MiniOptimizer::add(const std::string & filename) {
+  filenames_.push_back(filename);
+}
+
+/// Optimizes all added files.
+int MiniOptimizer::run() {
+  int failures = 0;
+
+  std::vector<PSFLibSet> lib_sets = resolve_2sf_sets(filenames_,
+    [&failures](size_t, const std::exception & ex) {
+      std::cout << "Error: " << ex.what() << std::endl;
+      failures++;
+    });
+
+  std::vector<char> base_data;
+  std::vector<char> data;
+  for (const PSFLibSet & lib_set : lib_sets) {
+    std::unique_ptr<RomOverlay> libs;
+    for (size_t i = 0; i < lib_set.programs.size(); i++) {
+      const PSFProgram & program = lib_set.programs[i];
+      const std::string & filename = filenames_[lib_set.file_indices[i]];
+
+      try {
+        // a file without psflibs has nothing to be compared with
+        if (lib_set.lib_programs.empty()) {
+          std::cout << filename << ": " << "No psflibs, skipped." << std::endl;
+          continue;
+        }
+
+        // decompress the psflibs once for each set, only the range of the
+        // program is read from them
+        if (!libs) {
+          libs.reset(new RomOverlay(lib_set.lib_programs));
+        }
+
+        data.resize(program.load_size);
+        inflate_program(program, data.data());
+        base_data.resize(program.load_size);
+        libs->read(program.load_offset, base_data.data(), base_data.size());
+
+        // find the ranges which differ from the psflibs
+        size_t split_gap = options_.split ? kMiniOptimizerSplitGap : std::numeric_limits<size_t>::max();
+        const char * base = base_data.data();
+        std::vector<std::pair<size_t, size_t>> ranges;
+        for (size_t position = 0; position < data.size(); position++) {
+          if (data[position] == base[position]) {
+            continue;
+          }
+
+          if (!ranges.empty() && position - ranges.back().second < split_gap) {
+            ranges.back().second = position + 1;
+          }
+          else {
+            ranges.push_back(std::make_pair(position, position + 1));
+          }
+        }
+
+        // keep a byte at least, for the program identical to the psflibs
+        if (ranges.empty()) {
+          ranges.push_back(std::make_pair(size_t(0), std::min<size_t>(data.size(), 1)));
+        }
+
+        // the first range remains in the file, the rest are split into psflibs
+        PSFFile psf = program.psf;
+        set_program(psf, static_cast<uint32_t>(program.load_offset + ranges[0].first),
+          &data[ranges[0].first], ranges[0].second - ranges[0].first);
+        size_t new_size = psf.compressed_exe().size();
+
+        int lib_index = 1;
+        while (psf.tags().count(get_lib_tag_name(lib_index)) != 0) {
+          lib_index++;
+        }
+
+        std::vector<std::pair<std::string, PSFFile>> parts;
+        for (size_t range_index = 1; range_index < ranges.size(); range_index++) {
+          const char * filename_c = filename.c_str();
+          off_t ext = path_findext(filename_c) - filename_c;
+          std::string part_filename = filename.substr(0, ext) + ".part" + std::to_string(range_index) + ".2sflib";
+
+          PSFFile part;
+          part.set_version(psf.version());
+          set_program(part, static_cast<uint32_t>(program.load_offset + ranges[range_index].first),
+            &data[ranges[range_index].first], ranges[range_index].second - ranges[range_index].first);
+          new_size += part.compressed_exe().size();
+
+          psf.tags()[get_lib_tag_name(lib_index)] = path_findbase(part_filename.c_str());
+          lib_index++;
+          parts.push_back(std::make_pair(part_filename, std::move(part)));
+        }
+
+        if (new_size >= program.psf.compressed_exe().size()) {
+          std::cout << filename << ": " << "Already minimal." << std::endl;
+          continue;
+        }
+
+        for (const auto & part : parts) {
+          part.second.write(part.first);
+        }
+        replace_psf_file(psf, filename);
+
+        std::cout << filename << ": " << program.psf.compressed_exe().size() << " -> "
+          << new_size << " bytes of compressed program";
+        if (!parts.empty()) {
+          std::cout << " (" << parts.size() << " psflibs split)";
+        }
+        std::cout << std::endl;
+      }
+      catch (std::exception & ex) {
+        std::cout << "Error: " << ex.what() << std::endl;
+        failures++;
+      }
+    }
+  }
+
+  return failures;
+}
@@ -0,0 +1,52 @@
+/// @file
+/// MiniOptimizer class header.
+
+#ifndef MINI_OPTIMIZER_HPP_
+#define MINI_OPTIMIZER_HPP_
+
+#include <string>
+#include <vector>
+
+/// Differing ranges apart by this or more are split into psflibs.
+constexpr size_t kMiniOptimizerSplitGap = 64 * 1024;
+
+/// The MiniOptimizerOptions struct represents the options of MiniOptimizer.
+struct MiniOptimizerOptions {
+  /// True to split distant differing ranges into psflibs.
+  bool split = false;
+};
+
+/// The MiniOptimizer class shrinks mini2SF programs to the bytes which
+/// differ from their psflibs.
+///
+/// The psflibs are composed once for each set of files sharing them, and
+/// the program of each file is compared with the composed image. The program
+/// is cut down to the range covering the differing bytes, recompressed, and
+/// replaced atomically by a new file, leaving other hard links alone. With the split option, ranges apart by
+/// kMiniOptimizerSplitGap or more are written as separate psflibs
+/// (filename.partN.2sflib) chained by additional _libN tags.
+class MiniOptimizer {
+public:
+  /// Constructs a new MiniOptimizer.
+  /// @param options the options of optimization.
+  explicit MiniOptimizer(const MiniOptimizerOptions & options = MiniOptimizerOptions());
+
+  /// Adds a file to be optimized.
+  /// @param filename the path to mini2sf file.
+  void add(const std::string & filename);
+
+  /// Optimizes all added files.
+  /// @return the number of files which failed to be optimized.
+  ///
+  /// @remarks Results and errors are reported to the standard output.
+  int run();
+
+private:
+  /// The options of optimization.
+  MiniOptimizerOptions options_;
+
+  /// Files to be optimized.
+  std::vector<std::string> filenames_;
+};
+
+#endif // !MINI_OPTIMIZER_HPP_
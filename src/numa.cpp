@@ -0,0 +1,104 @@
+/// @file
+/// NUMA topology helpers implementation.
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#endif
+
+#include "numa.hpp"
+
+/// Returns the NUMA nodes which have CPUs.
+std::vector<NumaNode> get_numa_nodes() {
+  std::vector<NumaNode> nodes;
+
+#ifdef __linux__
+  const std::string node_directory = "/sys/devices/system/node";
+  DIR * dir = opendir(node_directory.c_str());
+  if (dir != NULL) {
+    struct dirent * entry;
+    while ((entry = readdir(dir)) != NULL) {
+      std::string name(entry->d_name);
+      if (name.compare(0, 4, "node") != 0 || name.size() == 4 ||
+          name.find_first_not_of("0123456789", 4) != std::string::npos) {
+        continue;
+      }
+
+      std::ifstream cpulist_file(node_directory + "/" + name + "/cpulist");
+      std::string cpulist;
+      if (!std::getline(cpulist_file, cpulist)) {
+        continue;
+      }
+
+      NumaNode node;
+      node.id = atoi(name.c_str() + 4);
+      node.cpus = parse_cpu_list(cpulist);
+      if (!node.cpus.empty()) {
+        nodes.push_back(std::move(node));
+      }
+    }
+    closedir(dir);
+  }
+#endif
+
+  if (nodes.empty()) {
+    nodes.push_back(NumaNode{ 0, std::vector<unsigned int>() });
+  }
+
+  std::sort(nodes.begin(), nodes.end(), [](const NumaNode & a, const NumaNode & b) {
+    return a.id < b.id;
+  });
+  return nodes;
+}
+
+/// Parses a CPU list such as "0-3,8-11".
+std::vector<unsigned int> parse_cpu_list(const std::string & cpulist) {
+  std::vector<unsigned int> cpus;
+  std::istringstream cpulist_reader(cpulist);
+  std::string range;
+  while (std::getline(cpulist_reader, range, ',')) {
+    if (range.empty() || range.find_first_of("0123456789") != 0) {
+      continue;
+    }
+
+    unsigned int first = static_cast<unsigned int>(strtoul(range.c_str(), NULL, 10));
+    unsigned int last = first;
+    size_t dash = range.find('-');
+    if (dash != std::string::npos) {
+      last = static_cast<unsigned int>(strtoul(range.c_str() + dash + 1, NULL, 10));
+    }
+
+    for (unsigned int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+/// Binds the calling thread to the CPUs.
+bool bind_current_thread(const std::vector<unsigned int> & cpus) {
+#ifdef __linux__
+  if (cpus.empty()) {
+    return false;
+  }
+
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (unsigned int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &cpu_set);
+    }
+  }
+  return sched_setaffinity(0, sizeof(cpu_set), &cpu_set) == 0;
+#else
+  return false;
+#endif
+}
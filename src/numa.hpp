@@ -0,0 +1,39 @@
+/// @file
+/// NUMA topology helpers.
+
+#ifndef NUMA_HPP_
+#define NUMA_HPP_
+
+#include <string>
+#include <vector>
+
+/// The NumaNode struct represents a NUMA node which has CPUs.
+struct NumaNode {
+  /// The node number.
+  int id;
+
+  /// The CPUs of the node.
+  std::vector<unsigned int> cpus;
+};
+
+/// Returns the NUMA nodes which have CPUs.
+/// @return the nodes in the order of node numbers, or a single node without
+/// CPUs if the topology is unknown.
+///
+/// @remarks The topology is read from /sys/devices/system/node on Linux.
+std::vector<NumaNode> get_numa_nodes();
+
+/// Parses a CPU list such as "0-3,8-11".
+/// @param cpulist the CPU list.
+/// @return the CPUs in the list.
+std::vector<unsigned int> parse_cpu_list(const std::string & cpulist);
+
+/// Binds the calling thread to the CPUs.
+/// @param cpus the CPUs.
+/// @return true if the thread is bound.
+///
+/// @remarks Memory first touched by the thread is allocated on the node of
+/// the CPUs under the default memory policy.
+bool bind_current_thread(const std::vector<unsigned int> & cpus);
+
+#endif // !NUMA_HPP_
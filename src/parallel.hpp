@@ -0,0 +1,70 @@
+/// @file
+/// Simple parallel loop helper.
+
+#ifndef PARALLEL_HPP_
+#define PARALLEL_HPP_
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Returns the default number of worker threads.
+/// @return the number of hardware threads, at least 1.
+inline unsigned int get_default_thread_count() {
+  unsigned int thread_count = std::thread::hardware_concurrency();
+  return (thread_count != 0) ? thread_count : 1;
+}
+
+/// Runs a function for each index on multiple threads.
+/// @param count the number of indices.
+/// @param thread_count the maximum number of threads, 0 for the default.
+/// @param function the function called with each index in [0, count).
+///
+/// @remarks The first exception thrown by the function stops the loop,
+/// and is rethrown to the caller.
+template <typename Function>
+void parallel_for(size_t count, unsigned int thread_count, Function function) {
+  if (thread_count == 0) {
+    thread_count = get_default_thread_count();
+  }
+  thread_count = static_cast<unsigned int>(std::min<size_t>(thread_count, count));
+
+  std::atomic<size_t> next_index(0);
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto worker = [&]() {
+    size_t index;
+    while ((index = next_index++) < count) {
+      try {
+        function(index);
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        next_index = count;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < thread_count; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread & thread : threads) {
+    thread.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+#endif // !PARALLEL_HPP_
@@ -0,0 +1,128 @@
+/// @file
+/// PathCache class implementation.
+
+#include <limits.h>
+#include <stdlib.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#include "path_cache.hpp"
+#include "rom_loader.hpp"
+#include "cpath.h"
+
+/// Constructs a new PathCache.
+PathCache::PathCache() {
+}
+
+/// Closes the directories.
+PathCache::~PathCache() {
+#ifndef _WIN32
+  for (const auto & pair : directories_) {
+    if (pair.second.fd != -1) {
+      close(pair.second.fd);
+    }
+  }
+#endif
+}
+
+/// Resolves the absolute path of a file.
+std::string PathCache::resolve(const std::string & filename, bool & exists) {
+  exists = true;
+
+#ifndef _WIN32
+  size_t separator = filename.find_last_of(PATH_SEPARATOR_CHAR);
+  std::string directory_path = (separator == std::string::npos) ? "." :
+    (separator == 0) ? PATH_SEPARATOR_STR : filename.substr(0, separator);
+  std::string name = (separator == std::string::npos) ? filename : filename.substr(separator + 1);
+
+  if (!name.empty() && name != "." && name != "..") {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // open the directory once, every file in it is looked up relative to it
+    auto directory_it = directories_.find(directory_path);
+    if (directory_it == directories_.end()) {
+      Directory directory;
+      directory.fd = open(directory_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      char absolute_path[PATH_MAX];
+      if (directory.fd != -1 && realpath(directory_path.c_str(), absolute_path) != NULL) {
+        directory.path = absolute_path;
+      }
+      else if (directory.fd != -1) {
+        close(directory.fd);
+        directory.fd = -1;
+      }
+      directory_it = directories_.emplace(directory_path, directory).first;
+    }
+
+    const Directory & directory = directory_it->second;
+    if (directory.fd != -1) {
+      auto key = std::make_pair(directory.fd, name);
+      auto file_it = files_.find(key);
+      if (file_it == files_.end()) {
+        File file;
+        file.exists = true;
+
+        struct stat st;
+        if (fstatat(directory.fd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+          file.exists = false;
+        }
+
+        // a symbolic link is canonicalised to its target, as realpath does
+        char absolute_path[PATH_MAX];
+        if (file.exists && S_ISLNK(st.st_mode)) {
+          if (realpath(filename.c_str(), absolute_path) != NULL) {
+            file.path = absolute_path;
+          }
+          else {
+            file.exists = false;
+          }
+        }
+        if (file.path.empty()) {
+          file.path = directory.path;
+          if (file.path != PATH_SEPARATOR_STR) {
+            file.path += PATH_SEPARATOR_STR;
+          }
+          file.path += name;
+        }
+        file_it = files_.emplace(key, file).first;
+      }
+
+      exists = file_it->second.exists;
+      return file_it->second.path;
+    }
+  }
+#endif
+
+  // fall back to the plain lookup, the file is checked on opening
+  char absolute_path[PATH_MAX];
+  if (path_getabspath(filename.c_str(), absolute_path) == NULL) {
+    return std::string();
+  }
+  return absolute_path;
+}
+
+/// Finds the program of a psflib resolved before.
+bool PathCache::find_program(const std::string & absolute_path, PSFProgram & program) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = programs_.find(absolute_path);
+  if (it == programs_.end()) {
+    return false;
+  }
+  program = it->second;
+  return true;
+}
+
+/// Adds the program of a psflib.
+void PathCache::add_program(const PSFProgram & program) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  programs_.emplace(program.filename, program);
+}
@@ -0,0 +1,82 @@
+/// @file
+/// PathCache class header.
+
+#ifndef PATH_CACHE_HPP_
+#define PATH_CACHE_HPP_
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "rom_loader.hpp"
+
+/// The PathCache class caches the path lookups of a batch of 2SF files.
+///
+/// Each directory is opened and canonicalised once, and each file is looked
+/// up with fstatat relative to the descriptor of its directory, keyed by
+/// (directory descriptor, name). The validated programs of psflibs are kept
+/// as well, so a psflib shared by the files of a batch is read and checked
+/// once. The files are assumed not to change during the batch.
+///
+/// @remarks All member functions are thread-safe.
+class PathCache {
+public:
+  /// Constructs a new PathCache.
+  PathCache();
+
+  PathCache(const PathCache &) = delete;
+  PathCache & operator=(const PathCache &) = delete;
+
+  /// Closes the directories.
+  ~PathCache();
+
+  /// Resolves the absolute path of a file.
+  /// @param filename the path to the file.
+  /// @param exists set to false if the file is known not to exist.
+  /// @return the absolute path of the file.
+  std::string resolve(const std::string & filename, bool & exists);
+
+  /// Finds the program of a psflib resolved before.
+  /// @param absolute_path the absolute path of the psflib.
+  /// @param program the program to be filled.
+  /// @return true if the program is found.
+  bool find_program(const std::string & absolute_path, PSFProgram & program);
+
+  /// Adds the program of a psflib.
+  /// @param program the validated program.
+  void add_program(const PSFProgram & program);
+
+private:
+  /// The Directory struct represents an opened directory.
+  struct Directory {
+    /// The descriptor of the directory, -1 if it cannot be opened.
+    int fd;
+
+    /// The canonical path of the directory.
+    std::string path;
+  };
+
+  /// The File struct represents the result of a lookup.
+  struct File {
+    /// The absolute path of the file.
+    std::string path;
+
+    /// False if the file does not exist.
+    bool exists;
+  };
+
+  /// The mutex guarding the caches.
+  std::mutex mutex_;
+
+  /// The directories keyed by the paths given.
+  std::map<std::string, Directory> directories_;
+
+  /// The files keyed by the descriptor of the directory and the name.
+  std::map<std::pair<int, std::string>, File> files_;
+
+  /// The programs of psflibs keyed by the absolute paths.
+  std::map<std::string, PSFProgram> programs_;
+};
+
+#endif // !PATH_CACHE_HPP_
@@ -0,0 +1,62 @@
+/// @file
+/// USDT probes of the conversion.
+///
+/// The probes are defined by sys/sdt.h when HAVE_SYS_SDT_H is defined, and
+/// compiled out otherwise (their arguments are not evaluated). The provider
+/// name is twosf2rom, and string arguments are NUL-terminated paths.
+///
+/// - psf_open(path, size, duration_ns): a PSF file is read and parsed.
+/// - crc_verify(path, size, ok): the CRC32 of a compressed program is checked.
+/// - lib_resolve(path, lib_path, nest_level): a psflib is about to be resolved.
+/// - inflate_start(path, load_offset, load_size): decompression starts.
+/// - inflate_end(path, load_size, duration_ns): decompression ends.
+/// - rom_write(path, size, duration_ns): a ROM file is written.
+
+#ifndef PROBES_H_
+#define PROBES_H_
+
+#include <stdint.h>
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#include <chrono>
+
+/// Returns the timestamp for the durations of probes.
+/// @return the timestamp in nanoseconds.
+inline uint64_t probe_timestamp() {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/// Declares a variable holding the current timestamp.
+#define PROBE_DECLARE_TIMESTAMP(name) uint64_t name = probe_timestamp()
+
+#define PROBE_PSF_OPEN(path, size, duration_ns) \
+  DTRACE_PROBE3(twosf2rom, psf_open, path, size, duration_ns)
+#define PROBE_CRC_VERIFY(path, size, ok) \
+  DTRACE_PROBE3(twosf2rom, crc_verify, path, size, ok)
+#define PROBE_LIB_RESOLVE(path, lib_path, nest_level) \
+  DTRACE_PROBE3(twosf2rom, lib_resolve, path, lib_path, nest_level)
+#define PROBE_INFLATE_START(path, load_offset, load_size) \
+  DTRACE_PROBE3(twosf2rom, inflate_start, path, load_offset, load_size)
+#define PROBE_INFLATE_END(path, load_size, duration_ns) \
+  DTRACE_PROBE3(twosf2rom, inflate_end, path, load_size, duration_ns)
+#define PROBE_ROM_WRITE(path, size, duration_ns) \
+  DTRACE_PROBE3(twosf2rom, rom_write, path, size, duration_ns)
+
+#else
+
+#define PROBE_DECLARE_TIMESTAMP(name)
+
+#define PROBE_PSF_OPEN(path, size, duration_ns) do { } while (0)
+#define PROBE_CRC_VERIFY(path, size, ok) do { } while (0)
+#define PROBE_LIB_RESOLVE(path, lib_path, nest_level) do { } while (0)
+#define PROBE_INFLATE_START(path, load_offset, load_size) do { } while (0)
+#define PROBE_INFLATE_END(path, load_size, duration_ns) do { } while (0)
+#define PROBE_ROM_WRITE(path, size, duration_ns) do { } while (0)
+
+#endif // HAVE_SYS_SDT_H
+
+#endif // !PROBES_H_
@@ -0,0 +1,140 @@
+/// @file
+/// 2SF program compression implementation.
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "byteio.hpp"
+#include "parallel.hpp"
+#include "program_deflater.hpp"
+
+namespace {
+
+/// The size of the dictionary of deflate.
+constexpr size_t kDeflateWindowSize = 32 * 1024;
+
+/// Compress a chunk of data into raw deflate blocks.
+/// @param data the chunk.
+/// @param size the size of the chunk.
+/// @param dictionary the data preceding the chunk.
+/// @param dictionary_size the size of the dictionary.
+/// @param level the compression level of zlib.
+/// @param last true to end the deflate stream, false for a sync flush.
+/// @return the compressed chunk.
+std::string deflate_chunk(const char * data, size_t size, const char * dictionary, size_t dictionary_size,
+    int level, bool last) {
+  z_stream z = {};
+  if (deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw std::runtime_error("Unable to initialize zlib.");
+  }
+  if (dictionary_size != 0) {
+    deflateSetDictionary(&z, reinterpret_cast<const Bytef *>(dictionary), static_cast<uInt>(dictionary_size));
+  }
+
+  // a sync flush appends an empty stored block
+  std::string compressed(deflateBound(&z, static_cast<uLong>(size)) + 16, 0);
+  z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+  z.avail_in = static_cast<uInt>(size);
+  z.next_out = reinterpret_cast<Bytef *>(&compressed[0]);
+  z.avail_out = static_cast<uInt>(compressed.size());
+  int zresult = deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+  bool success = last ? (zresult == Z_STREAM_END) : (zresult == Z_OK && z.avail_in == 0 && z.avail_out != 0);
+  compressed.resize(compressed.size() - z.avail_out);
+  deflateEnd(&z);
+
+  if (!success) {
+    throw std::runtime_error("Failed to compress the program.");
+  }
+  return compressed;
+}
+
+} // namespace
+
+/// Compress a program area with its header, for the compressed program of 2SF.
+std::string deflate_program(uint32_t load_offset, const char * data, uint32_t size, int level) {
+  // the exe header
+  // - 4 bytes offset
+  // - 4 bytes size
+  char header[8];
+  WriteInt32L(WriteInt32L(header, load_offset), size);
+
+  z_stream z = {};
+  if (deflateInit(&z, level) != Z_OK) {
+    throw std::runtime_error("Unable to initialize zlib.");
+  }
+
+  std::string compressed_exe(deflateBound(&z, sizeof(header) + size), 0);
+  z.next_out = reinterpret_cast<Bytef *>(&compressed_exe[0]);
+  z.avail_out = static_cast<uInt>(compressed_exe.size());
+
+  z.next_in = reinterpret_cast<Bytef *>(header);
+  z.avail_in = sizeof(header);
+  int zresult = deflate(&z, Z_NO_FLUSH);
+  if (zresult == Z_OK) {
+    z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    z.avail_in = size;
+    zresult = deflate(&z, Z_FINISH);
+  }
+  compressed_exe.resize(compressed_exe.size() - z.avail_out);
+  deflateEnd(&z);
+
+  if (zresult != Z_STREAM_END) {
+    throw std::runtime_error("Failed to compress the program.");
+  }
+  return compressed_exe;
+}
+
+/// Compress a program area with its header on multiple threads.
+std::string deflate_program_parallel(uint32_t load_offset, const char * data, uint32_t size,
+    int level, unsigned int thread_count) {
+  if (size <= kProgramDeflateChunkSize) {
+    return deflate_program(load_offset, data, size, level);
+  }
+
+  // the stream consists of the exe header and the program
+  std::vector<char> input(8 + static_cast<size_t>(size));
+  WriteInt32L(WriteInt32L(input.data(), load_offset), size);
+  std::copy(data, data + size, input.begin() + 8);
+
+  size_t chunk_count = (input.size() + kProgramDeflateChunkSize - 1) / kProgramDeflateChunkSize;
+  std::vector<std::string> chunks(chunk_count);
+  std::vector<uLong> checksums(chunk_count);
+  parallel_for(chunk_count, thread_count, [&](size_t chunk_index) {
+    size_t chunk_offset = chunk_index * kProgramDeflateChunkSize;
+    size_t chunk_size = std::min(kProgramDeflateChunkSize, input.size() - chunk_offset);
+    size_t dictionary_size = std::min(kDeflateWindowSize, chunk_offset);
+    chunks[chunk_index] = deflate_chunk(input.data() + chunk_offset, chunk_size,
+      input.data() + chunk_offset - dictionary_size, dictionary_size, level, chunk_index + 1 == chunk_count);
+    checksums[chunk_index] = adler32(adler32(0L, Z_NULL, 0),
+      reinterpret_cast<const Bytef *>(input.data() + chunk_offset), static_cast<uInt>(chunk_size));
+  });
+
+  // the zlib header, with the level hint of deflateInit
+  int level_hint = (level == Z_DEFAULT_COMPRESSION) ? 2 : (level < 2) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3;
+  unsigned int header = (0x78 << 8) | (level_hint << 6);
+  header += 31 - (header % 31);
+
+  std::string compressed_exe;
+  compressed_exe += static_cast<char>(header >> 8);
+  compressed_exe += static_cast<char>(header & 0xff);
+
+  uLong checksum = adler32(0L, Z_NULL, 0);
+  for (size_t chunk_index = 0; chunk_index < chunk_count; chunk_index++) {
+    size_t chunk_size = std::min(kProgramDeflateChunkSize, input.size() - chunk_index * kProgramDeflateChunkSize);
+    checksum = adler32_combine(checksum, checksums[chunk_index], static_cast<z_off_t>(chunk_size));
+    compressed_exe += chunks[chunk_index];
+  }
+
+  // the adler32 trailer in big-endian
+  compressed_exe += static_cast<char>((checksum >> 24) & 0xff);
+  compressed_exe += static_cast<char>((checksum >> 16) & 0xff);
+  compressed_exe += static_cast<char>((checksum >> 8) & 0xff);
+  compressed_exe += static_cast<char>(checksum & 0xff);
+  return compressed_exe;
+}
@@ -0,0 +1,39 @@
+/// @file
+/// 2SF program compression header.
+
+#ifndef PROGRAM_DEFLATER_HPP_
+#define PROGRAM_DEFLATER_HPP_
+
+#include <stdint.h>
+
+#include <string>
+
+#include <zlib.h>
+
+/// Compress a program area with its header, for the compressed program of 2SF.
+/// @param load_offset the offset of the program in the ROM image.
+/// @param data the program.
+/// @param size the size of the program.
+/// @param level the compression level of zlib.
+/// @return the compressed program.
+std::string deflate_program(uint32_t load_offset, const char * data, uint32_t size,
+  int level = Z_BEST_COMPRESSION);
+
+/// The size of chunks compressed in parallel by deflate_program_parallel.
+constexpr size_t kProgramDeflateChunkSize = 1024 * 1024;
+
+/// Compress a program area with its header on multiple threads.
+/// @param load_offset the offset of the program in the ROM image.
+/// @param data the program.
+/// @param size the size of the program.
+/// @param level the compression level of zlib.
+/// @param thread_count the maximum number of threads, 0 for the default.
+/// @return the compressed program, a single zlib stream.
+///
+/// @remarks The program is split into chunks of kProgramDeflateChunkSize,
+/// each compressed with the end of the previous chunk as the dictionary and
+/// terminated by a sync flush, and the checksums of the chunks are combined.
+std::string deflate_program_parallel(uint32_t load_offset, const char * data, uint32_t size,
+  int level = Z_BEST_COMPRESSION, unsigned int thread_count = 0);
+
+#endif // !PROGRAM_DEFLATER_HPP_
@@ -0,0 +1,254 @@
+/// @file
+/// PSF carver implementation.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+#include <zlib.h>
+
+#include "byteio.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include "psf_carver.hpp"
+#include "psf_file.hpp"
+#include "rom_loader.hpp"
+#include "cpath.h"
+
+namespace {
+
+/// The signature and version of 2SF.
+constexpr char k2SFSignature[] = { 'P', 'S', 'F', 0x24 };
+
+/// The size of the signature and version of 2SF.
+constexpr size_t k2SFSignatureSize = 4;
+
+/// The size of the PSF header.
+constexpr size_t kPSFHeaderSize = 0x10;
+
+/// The data of the PSF tag marker.
+constexpr auto kPSFTagMarker = "[TAG]";
+
+/// The length of the PSF tag marker
+constexpr size_t kPSFTagMarkerSize = 5;
+
+/// The maximum size of the reserved area and program of a candidate, beyond
+/// which the sizes are taken as garbage instead of computing its CRC32.
+constexpr uint64_t kCarveMaxBodySize = static_cast<uint64_t>(kNDSRomMaxSize) * 2;
+
+/// The number of bytes compared at once by the signature search.
+constexpr size_t kSignatureScanBlockSize = 16;
+
+/// Finds the next signature of 2SF.
+/// @param begin the start of the range.
+/// @param end the end of the range.
+/// @return the signature found, or end.
+const char * find_2sf_signature(const char * begin, const char * end) {
+  // 'P' alone is dense in text and tables, so the first and last bytes of the
+  // signature are compared together for a block of positions, and only the
+  // positions matching both are compared entirely
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  const __m128i first = _mm_set1_epi8(k2SFSignature[0]);
+  const __m128i last = _mm_set1_epi8(k2SFSignature[k2SFSignatureSize - 1]);
+  while (static_cast<size_t>(end - begin) >= kSignatureScanBlockSize + k2SFSignatureSize - 1) {
+    __m128i first_block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+    __m128i last_block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin + k2SFSignatureSize - 1));
+    int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first_block, first),
+      _mm_cmpeq_epi8(last_block, last)));
+    for (size_t index = 0; mask != 0; index++, mask >>= 1) {
+      if ((mask & 1) != 0 && memcmp(begin + index, k2SFSignature, k2SFSignatureSize) == 0) {
+        return begin + index;
+      }
+    }
+    begin += kSignatureScanBlockSize;
+  }
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  const uint8x16_t first = vdupq_n_u8(static_cast<uint8_t>(k2SFSignature[0]));
+  const uint8x16_t last = vdupq_n_u8(static_cast<uint8_t>(k2SFSignature[k2SFSignatureSize - 1]));
+  while (static_cast<size_t>(end - begin) >= kSignatureScanBlockSize + k2SFSignatureSize - 1) {
+    uint8x16_t first_block = vld1q_u8(reinterpret_cast<const uint8_t *>(begin));
+    uint8x16_t last_block = vld1q_u8(reinterpret_cast<const uint8_t *>(begin + k2SFSignatureSize - 1));
+    if (vmaxvq_u8(vandq_u8(vceqq_u8(first_block, first), vceqq_u8(last_block, last))) != 0) {
+      for (size_t index = 0; index < kSignatureScanBlockSize; index++) {
+        if (memcmp(begin + index, k2SFSignature, k2SFSignatureSize) == 0) {
+          return begin + index;
+        }
+      }
+    }
+    begin += kSignatureScanBlockSize;
+  }
+#else
+  // without SIMD, search the version byte by memchr, which is rarer than 'P'
+  // in text
+  while (static_cast<size_t>(end - begin) >= k2SFSignatureSize) {
+    const char * version = static_cast<const char *>(memchr(begin + k2SFSignatureSize - 1,
+      k2SFSignature[k2SFSignatureSize - 1], end - begin - (k2SFSignatureSize - 1)));
+    if (version == NULL) {
+      return end;
+    }
+    const char * candidate = version - (k2SFSignatureSize - 1);
+    if (memcmp(candidate, k2SFSignature, k2SFSignatureSize) == 0) {
+      return candidate;
+    }
+    begin = candidate + 1;
+  }
+#endif
+
+  // the remaining positions, fewer than a block
+  for (; static_cast<size_t>(end - begin) >= k2SFSignatureSize; begin++) {
+    if (memcmp(begin, k2SFSignature, k2SFSignatureSize) == 0) {
+      return begin;
+    }
+  }
+  return end;
+}
+
+/// Validates a candidate of 2SF file.
+/// @param data the binary.
+/// @param size the size of the binary.
+/// @param offset the offset of the signature.
+/// @param psf the file to be filled.
+/// @return true if the candidate is a 2SF file.
+bool validate_2sf(const char * data, size_t size, size_t offset, CarvedPSF & psf) {
+  if (size - offset < kPSFHeaderSize) {
+    return false;
+  }
+
+  uint32_t reserved_size;
+  uint32_t compressed_exe_size;
+  uint32_t compressed_exe_crc32;
+  ReadInt32L(data + offset + 0x04, reserved_size);
+  ReadInt32L(data + offset + 0x08, compressed_exe_size);
+  ReadInt32L(data + offset + 0x0C, compressed_exe_crc32);
+
+  // the sizes must fit in the binary, and the program must look like zlib
+  // (CMF of deflate, and the check bits of CMF/FLG) before the CRC32
+  uint64_t body_size = static_cast<uint64_t>(reserved_size) + compressed_exe_size;
+  if (compressed_exe_size < 2 || body_size > kCarveMaxBodySize ||
+      body_size > size - offset - kPSFHeaderSize) {
+    return false;
+  }
+  const unsigned char * compressed_exe = reinterpret_cast<const unsigned char *>(
+    data + offset + kPSFHeaderSize + reserved_size);
+  if ((compressed_exe[0] & 0x0f) != Z_DEFLATED || ((compressed_exe[0] << 8) | compressed_exe[1]) % 31 != 0) {
+    return false;
+  }
+  if (::crc32(0L, compressed_exe, compressed_exe_size) != compressed_exe_crc32) {
+    return false;
+  }
+
+  // the tag area has no size, it is taken as the text following the marker
+  // up to a control character or the next signature, and a last line without
+  // '=' (the bytes following the file) is dropped
+  size_t end = offset + kPSFHeaderSize + static_cast<size_t>(body_size);
+  if (size - end >= kPSFTagMarkerSize && memcmp(data + end, kPSFTagMarker, kPSFTagMarkerSize) == 0) {
+    size_t tag_limit = end + std::min(size - end, kPSFMaxTagSize);
+    tag_limit = find_2sf_signature(data + end, data + tag_limit) - data;
+
+    size_t tag_end = end + kPSFTagMarkerSize;
+    size_t line_start = tag_end;
+    bool line_has_value = false;
+    for (; tag_end < tag_limit; tag_end++) {
+      unsigned char c = static_cast<unsigned char>(data[tag_end]);
+      if (c == '\n') {
+        line_start = tag_end + 1;
+        line_has_value = false;
+      }
+      else if (c == '=') {
+        line_has_value = true;
+      }
+      else if ((c < 0x20 && c != '\t' && c != '\r') || c == 0x7f) {
+        break;
+      }
+    }
+    end = line_has_value ? tag_end : line_start;
+  }
+
+  psf.offset = offset;
+  psf.size = end - offset;
+  psf.has_libs = false;
+  try {
+    PSFFile file(data + offset, psf.size, std::string());
+    for (const auto & tag : file.tags()) {
+      if (tag.first.compare(0, 4, "_lib") == 0 &&
+          tag.first.find_first_not_of("0123456789", 4) == std::string::npos) {
+        psf.has_libs = true;
+      }
+    }
+  }
+  catch (const std::exception &) {
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+/// Find the 2SF files embedded in a binary.
+std::vector<CarvedPSF> carve_2sf(const char * data, size_t size, unsigned int thread_count) {
+  // each range owns the signatures starting in it, so no file is found twice
+  size_t chunk_count = (size + kCarveScanChunkSize - 1) / kCarveScanChunkSize;
+  std::vector<std::vector<CarvedPSF>> chunk_files(chunk_count);
+  parallel_for(chunk_count, thread_count, [&](size_t chunk_index) {
+    size_t begin = chunk_index * kCarveScanChunkSize;
+    size_t end = std::min(size, begin + kCarveScanChunkSize);
+
+    // the signature may straddle the end of the range
+    const char * search_end = data + std::min(size, end + k2SFSignatureSize - 1);
+    const char * candidate = data + begin;
+    while ((candidate = find_2sf_signature(candidate, search_end)) < data + end) {
+      CarvedPSF psf;
+      if (validate_2sf(data, size, candidate - data, psf)) {
+        chunk_files[chunk_index].push_back(psf);
+      }
+      candidate++;
+    }
+  });
+
+  std::vector<CarvedPSF> files;
+  for (const std::vector<CarvedPSF> & chunk : chunk_files) {
+    files.insert(files.end(), chunk.begin(), chunk.end());
+  }
+  return files;
+}
+
+/// Extract the 2SF files embedded in a file.
+std::vector<CarvedPSF> carve_2sf_file(const std::string & filename, const std::string & output_directory,
+    unsigned int thread_count) {
+  MappedFile input(filename);
+  std::vector<CarvedPSF> files = carve_2sf(input.data(), input.size(), thread_count);
+
+  parallel_for(files.size(), thread_count, [&](size_t file_index) {
+    const CarvedPSF & psf = files[file_index];
+    std::ofstream out;
+    out.exceptions(std::ios::badbit | std::ios::failbit);
+    out.open(get_carved_filename(filename, output_directory, psf), std::ios::binary);
+    out.write(input.data() + psf.offset, psf.size);
+  });
+  return files;
+}
+
+/// Returns the output filename of a carved file.
+std::string get_carved_filename(const std::string & filename, const std::string & output_directory,
+    const CarvedPSF & psf) {
+  char offset_string[32];
+  snprintf(offset_string, sizeof(offset_string), "%012llx", static_cast<unsigned long long>(psf.offset));
+
+  std::string carved_filename = std::string(path_findbase(filename.c_str())) + "." + offset_string +
+    (psf.has_libs ? ".mini2sf" : ".2sf");
+  if (!output_directory.empty()) {
+    carved_filename = output_directory + PATH_SEPARATOR_STR + carved_filename;
+  }
+  return carved_filename;
+}
@@ -0,0 +1,67 @@
+/// @file
+/// PSF carver header.
+
+#ifndef PSF_CARVER_HPP_
+#define PSF_CARVER_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/// The size of the range of an input scanned at once by a thread.
+constexpr size_t kCarveScanChunkSize = 64 * 1024 * 1024;
+
+/// The maximum size of the tag area of PSF, including the tag marker.
+constexpr size_t kPSFMaxTagSize = 50000;
+
+/// The CarvedPSF struct represents a PSF file found in a binary.
+struct CarvedPSF {
+  /// The offset of the file in the binary.
+  uint64_t offset;
+
+  /// The size of the file, including the tag area.
+  size_t size;
+
+  /// True if the file has _lib tags (mini2SF).
+  bool has_libs;
+};
+
+/// Find the 2SF files embedded in a binary.
+/// @param data the binary.
+/// @param size the size of the binary.
+/// @param thread_count the number of threads scanning the binary, 0 for the
+/// default.
+/// @return the files found, in the order of offsets.
+///
+/// @remarks A candidate is the signature "PSF" followed by the version 0x24,
+/// whose header fits in the binary, whose program starts with a zlib header,
+/// and whose CRC32 matches the program. The tag area, if any, ends at the
+/// first control character, at the next signature, or at kPSFMaxTagSize
+/// bytes, excluding a last line without '='. The binary
+/// is split into ranges of kCarveScanChunkSize bytes scanned in parallel, and
+/// a file may extend beyond the range in which it starts.
+std::vector<CarvedPSF> carve_2sf(const char * data, size_t size, unsigned int thread_count = 0);
+
+/// Extract the 2SF files embedded in a file.
+/// @param filename the path to the file, which is memory-mapped.
+/// @param output_directory the directory receiving the files.
+/// @param thread_count the number of threads, 0 for the default.
+/// @return the files found.
+///
+/// @remarks The files are named after the input file and their offsets in
+/// hexadecimal, with .mini2sf or .2sf extension. The names of psflibs cannot
+/// be recovered, so _lib tags are left as they are.
+std::vector<CarvedPSF> carve_2sf_file(const std::string & filename, const std::string & output_directory,
+  unsigned int thread_count = 0);
+
+/// Returns the output filename of a carved file.
+/// @param filename the path to the input file.
+/// @param output_directory the directory receiving the files.
+/// @param psf the carved file.
+/// @return the path to the output file.
+std::string get_carved_filename(const std::string & filename, const std::string & output_directory,
+  const CarvedPSF & psf);
+
+#endif // !PSF_CARVER_HPP_
@@ -0,0 +1,417 @@
+/// @file
+/// PSFDeduplicator class implementation.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#endif
+
+#include <zlib.h>
+
+#include "byteio.hpp"
+#include "psf_dedup.hpp"
+#include "psf_file.hpp"
+#include "cpath.h"
+
+namespace {
+
+/// The PSFHeader struct represents the header of a PSF file.
+struct PSFHeader {
+  /// The absolute path of the file.
+  std::string filename;
+
+  /// Version byte.
+  uint8_t version;
+
+  /// Size of the reserved area.
+  uint32_t reserved_size;
+
+  /// Size of the compressed program.
+  uint32_t compressed_exe_size;
+
+  /// CRC32 of the compressed program.
+  uint32_t compressed_exe_crc32;
+};
+
+/// Read the header of a PSF file.
+/// @param filename the path to PSF file.
+/// @return the header of the file.
+PSFHeader read_psf_header(const std::string & filename) {
+  std::ifstream in;
+  in.exceptions(std::ios::badbit);
+  in.open(filename, std::ios::binary);
+
+  char signature[3];
+  in.read(signature, 3);
+  PSFHeader header;
+  if (in.gcount() != 3 || memcmp(signature, "PSF", 3) != 0 ||
+      !ReadStreamAsInt8(in, header.version) ||
+      !ReadStreamAsInt32L(in, header.reserved_size) ||
+      !ReadStreamAsInt32L(in, header.compressed_exe_size) ||
+      !ReadStreamAsInt32L(in, header.compressed_exe_crc32)) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Invalid PSF header.";
+    throw std::runtime_error(message_buffer.str());
+  }
+
+  char absolute_path[PATH_MAX];
+  if (path_getabspath(filename.c_str(), absolute_path) == NULL) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Unable to determine absolute path.";
+    throw std::out_of_range(message_buffer.str());
+  }
+  header.filename = absolute_path;
+  return header;
+}
+
+/// Read an entire file.
+/// @param filename the path to the file.
+/// @return the content of the file.
+std::string read_file(const std::string & filename) {
+  std::ifstream in;
+  in.exceptions(std::ios::badbit);
+  in.open(filename, std::ios::binary);
+  if (!in) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Unable to open the file.";
+    throw std::runtime_error(message_buffer.str());
+  }
+  return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+/// Returns the psflibs which a file is loaded on.
+/// @param filename the absolute path of the file.
+/// @param content the content of the file.
+/// @return the absolute paths of the psflibs of _lib and _libN tags, in the
+/// order of the tags, separated by newlines.
+std::string get_lib_chain(const std::string & filename, const std::string & content) {
+  char basedir[PATH_MAX];
+  strcpy(basedir, filename.c_str());
+  path_dirname(basedir);
+
+  PSFFile psf(content.data(), content.size(), filename);
+  std::string lib_chain;
+  for (int lib_index = 1; ; lib_index++) {
+    std::string lib_tag_name = "_lib";
+    if (lib_index > 1) {
+      lib_tag_name += std::to_string(lib_index);
+    }
+
+    auto it = psf.tags().find(lib_tag_name);
+    if (it == psf.tags().end()) {
+      break;
+    }
+
+    // the same name in different directories is a different psflib
+    std::string lib_path = it->second;
+    if (!path_isabs(lib_path.c_str())) {
+      lib_path = std::string(basedir) + PATH_SEPARATOR_STR + lib_path;
+    }
+    char lib_absolute_path[PATH_MAX];
+    if (path_getabspath(lib_path.c_str(), lib_absolute_path) != NULL) {
+      lib_path = lib_absolute_path;
+    }
+    lib_chain += lib_path;
+    lib_chain += '\n';
+  }
+  return lib_chain;
+}
+
+/// Returns the path of a file relative to a directory.
+/// @param directory the absolute path of the directory.
+/// @param filename the absolute path of the file.
+/// @return the relative path, or the absolute path if it cannot be relative.
+std::string get_relative_path(const std::string & directory, const std::string & filename) {
+  auto split = [](const std::string & path) {
+    std::vector<std::string> components;
+    std::istringstream path_reader(path);
+    std::string component;
+    while (std::getline(path_reader, component, PATH_SEPARATOR_CHAR)) {
+      if (!component.empty()) {
+        components.push_back(component);
+      }
+    }
+    return components;
+  };
+
+  std::vector<std::string> directory_components = split(directory);
+  std::vector<std::string> file_components = split(filename);
+  size_t common = 0;
+  while (common < directory_components.size() && common + 1 < file_components.size() &&
+      directory_components[common] == file_components[common]) {
+    common++;
+  }
+
+  // paths on different drives have nothing in common
+  if (common == 0) {
+    return filename;
+  }
+
+  std::string relative_path;
+  for (size_t i = common; i < directory_components.size(); i++) {
+    relative_path += "..";
+    relative_path += PATH_SEPARATOR_CHAR;
+  }
+  for (size_t i = common; i < file_components.size(); i++) {
+    if (i != common) {
+      relative_path += PATH_SEPARATOR_CHAR;
+    }
+    relative_path += file_components[i];
+  }
+  return relative_path;
+}
+
+/// Replace a file with a link to another file.
+/// @param source the path to the canonical file.
+/// @param target the path to the file to be replaced.
+/// @param mode how the file is replaced.
+/// @return false if the files are already linked.
+bool link_file(const std::string & source, const std::string & target, DedupLinkMode mode) {
+  // create the link at a temporary path, then replace the target atomically
+  std::string temporary_path = target + ".2sf2rom-tmp";
+
+#ifdef _WIN32
+  if (mode != DedupLinkMode::kHardlink) {
+    throw std::runtime_error("Reflinks are not supported on this platform.");
+  }
+
+  DeleteFileA(temporary_path.c_str());
+  if (!CreateHardLinkA(temporary_path.c_str(), source.c_str(), NULL) ||
+      !MoveFileExA(temporary_path.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+    DeleteFileA(temporary_path.c_str());
+    std::ostringstream message_buffer;
+    message_buffer << target << ": " << "Unable to replace the file with a link.";
+    throw std::runtime_error(message_buffer.str());
+  }
+#else
+  struct stat source_stat;
+  struct stat target_stat;
+  if (stat(source.c_str(), &source_stat) == 0 && stat(target.c_str(), &target_stat) == 0 &&
+      source_stat.st_dev == target_stat.st_dev && source_stat.st_ino == target_stat.st_ino) {
+    return false;
+  }
+
+  unlink(temporary_path.c_str());
+  int result = -1;
+  if (mode == DedupLinkMode::kHardlink) {
+    result = link(source.c_str(), temporary_path.c_str());
+  }
+  else {
+#ifdef FICLONE
+    int source_fd = open(source.c_str(), O_RDONLY);
+    if (source_fd != -1) {
+      int target_fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, source_stat.st_mode & 07777);
+      if (target_fd != -1) {
+        result = ioctl(target_fd, FICLONE, source_fd);
+        close(target_fd);
+      }
+      close(source_fd);
+    }
+#else
+    errno = ENOTSUP;
+#endif
+  }
+
+  if (result != 0 || rename(temporary_path.c_str(), target.c_str()) != 0) {
+    int error = errno;
+    unlink(temporary_path.c_str());
+    std::ostringstream message_buffer;
+    message_buffer << target << ": " << "Unable to replace the file with a link (" << strerror(error) << ").";
+    throw std::runtime_error(message_buffer.str());
+  }
+#endif
+  return true;
+}
+
+} // namespace
+
+/// Constructs a new PSFDeduplicator.
+PSFDeduplicator::PSFDeduplicator(const DedupOptions & options) :
+    options_(options) {
+}
+
+/// Adds a file to be examined.
+void PSFDeduplicator::add(const std::string & filename) {
+  filenames_.push_back(filename);
+}
+
+/// Finds and deduplicates the identical files.
+int PSFDeduplicator::run() {
+  int failures = 0;
+
+  // group the files by their headers, which is cheap to read
+  std::map<std::tuple<uint8_t, uint32_t, uint32_t, uint32_t>, std::vector<PSFHeader>> candidates;
+  for (const std::string & filename : filenames_) {
+    try {
+      PSFHeader header = read_psf_header(filename);
+      candidates[std::make_tuple(header.version, header.reserved_size,
+        header.compressed_exe_size, header.compressed_exe_crc32)].push_back(header);
+    }
+    catch (const std::exception & ex) {
+      std::cout << "Error: " << ex.what() << std::endl;
+      failures++;
+    }
+  }
+
+  // compare the candidates byte by byte, and map duplicates to canonical copies
+  std::map<std::string, std::string> canonical_paths;
+  for (const auto & pair : candidates) {
+    const std::vector<PSFHeader> & headers = pair.second;
+    if (headers.size() < 2) {
+      continue;
+    }
+
+    /// The Copy struct represents a distinct content in the group.
+    struct Copy {
+      std::string filename;
+      std::string content;
+      std::string lib_chain;
+    };
+    std::vector<Copy> copies;
+    for (const PSFHeader & header : headers) {
+      try {
+        std::string content = read_file(header.filename);
+        size_t program_size = static_cast<size_t>(header.reserved_size) + header.compressed_exe_size;
+        if (content.size() < 0x10 + program_size ||
+            ::crc32(0L, reinterpret_cast<const Bytef *>(&content[0x10 + header.reserved_size]),
+              header.compressed_exe_size) != header.compressed_exe_crc32) {
+          std::ostringstream message_buffer;
+          message_buffer << header.filename << ": " << "CRC32 error at the compressed program.";
+          throw std::runtime_error(message_buffer.str());
+        }
+
+        // find the copy which has the same reserved area and program, loaded
+        // on the same psflibs (a psflib merged with another one having a
+        // different chain would change the ROMs of the files using it)
+        std::string lib_chain = get_lib_chain(header.filename, content);
+        const Copy * canonical = nullptr;
+        for (const Copy & copy : copies) {
+          if (copy.lib_chain == lib_chain &&
+              copy.content.compare(0x10, program_size, content, 0x10, program_size) == 0) {
+            canonical = &copy;
+            break;
+          }
+        }
+        if (canonical == nullptr) {
+          copies.push_back(Copy{ header.filename, std::move(content), std::move(lib_chain) });
+          continue;
+        }
+
+        if (canonical->filename == header.filename) {
+          continue;
+        }
+        canonical_paths[header.filename] = canonical->filename;
+        std::cout << header.filename << ": " << "Same program as " << canonical->filename << std::endl;
+
+        // replace the file entirely identical to the canonical copy
+        if (options_.link_mode != DedupLinkMode::kNone) {
+          if (content != canonical->content) {
+            std::cout << header.filename << ": " << "Tags differ, not linked." << std::endl;
+          }
+          else if (link_file(canonical->filename, header.filename, options_.link_mode)) {
+            std::cout << header.filename << ": " << "Linked to " << canonical->filename << std::endl;
+          }
+        }
+      }
+      catch (const std::exception & ex) {
+        std::cout << "Error: " << ex.what() << std::endl;
+        failures++;
+      }
+    }
+  }
+
+  if (!options_.rewrite_libs || canonical_paths.empty()) {
+    return failures;
+  }
+
+  // rewrite _lib tags which point at duplicates
+  for (const std::string & filename : filenames_) {
+    try {
+      char absolute_path[PATH_MAX];
+      if (path_getabspath(filename.c_str(), absolute_path) == NULL) {
+        continue;
+      }
+      char basedir[PATH_MAX];
+      strcpy(basedir, absolute_path);
+      path_dirname(basedir);
+
+      PSFFile psf(filename);
+      bool modified = false;
+      for (int lib_index = 1; ; lib_index++) {
+        std::string lib_tag_name = "_lib";
+        if (lib_index > 1) {
+          lib_tag_name += std::to_string(lib_index);
+        }
+
+        auto it = psf.tags().find(lib_tag_name);
+        if (it == psf.tags().end()) {
+          break;
+        }
+
+        // resolve the lib path relative to the file
+        std::string lib_path = it->second;
+        char lib_absolute_path[PATH_MAX];
+        if (!path_isabs(lib_path.c_str())) {
+          lib_path = std::string(basedir) + PATH_SEPARATOR_STR + lib_path;
+        }
+        if (path_getabspath(lib_path.c_str(), lib_absolute_path) == NULL) {
+          continue;
+        }
+
+        auto canonical = canonical_paths.find(lib_absolute_path);
+        if (canonical != canonical_paths.end()) {
+          it->second = get_relative_path(basedir, canonical->second);
+          std::cout << filename << ": " << lib_tag_name << "=" << it->second << std::endl;
+          modified = true;
+        }
+      }
+
+      if (modified) {
+#ifndef _WIN32
+        // a linked file may be shared with another directory, so write a new file
+        struct stat st;
+        if (stat(filename.c_str(), &st) == 0 && st.st_nlink > 1) {
+          std::string temporary_path = filename + ".2sf2rom-tmp";
+          psf.write(temporary_path);
+          if (rename(temporary_path.c_str(), filename.c_str()) != 0) {
+            unlink(temporary_path.c_str());
+            std::ostringstream message_buffer;
+            message_buffer << filename << ": " << "Unable to replace the file.";
+            throw std::runtime_error(message_buffer.str());
+          }
+          continue;
+        }
+#endif
+        psf.write_tags(filename);
+      }
+    }
+    catch (const std::exception & ex) {
+      std::cout << "Error: " << ex.what() << std::endl;
+      failures++;
+    }
+  }
+
+  return failures;
+}
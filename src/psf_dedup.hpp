@@ -0,0 +1,67 @@
+/// @file
+/// PSFDeduplicator class header.
+
+#ifndef PSF_DEDUP_HPP_
+#define PSF_DEDUP_HPP_
+
+#include <string>
+#include <vector>
+
+/// The DedupLinkMode enum represents how duplicated files are replaced.
+enum class DedupLinkMode {
+  /// Duplicated files are only reported.
+  kNone,
+
+  /// Duplicated files are replaced with hardlinks.
+  kHardlink,
+
+  /// Duplicated files are replaced with reflinks (copy-on-write clones).
+  kReflink,
+};
+
+/// The DedupOptions struct represents the options of PSFDeduplicator.
+struct DedupOptions {
+  /// How duplicated files are replaced.
+  DedupLinkMode link_mode = DedupLinkMode::kNone;
+
+  /// True to rewrite _lib tags to point at the canonical copy.
+  bool rewrite_libs = false;
+};
+
+/// The PSFDeduplicator class finds PSF files having identical programs.
+///
+/// Files are first grouped by the sizes and the CRC32 in their headers,
+/// so only the candidates of duplicates are read entirely. Candidates are
+/// then compared byte by byte, and are duplicates only if their _lib tags
+/// also point at the same psflibs. The first file of each group of duplicates
+/// in the given order is the canonical copy.
+///
+/// Files which are entirely identical to the canonical copy can be replaced
+/// with links. Files which only share the program (with different tags) are
+/// reported, and can be deduplicated by rewriting the _lib tags of the
+/// files referring to them.
+class PSFDeduplicator {
+public:
+  /// Constructs a new PSFDeduplicator.
+  /// @param options the options of deduplication.
+  explicit PSFDeduplicator(const DedupOptions & options = DedupOptions());
+
+  /// Adds a file to be examined.
+  /// @param filename the path to PSF file.
+  void add(const std::string & filename);
+
+  /// Finds and deduplicates the identical files.
+  /// @return the number of files which failed to be processed.
+  ///
+  /// @remarks Results and errors are reported to the standard output.
+  int run();
+
+private:
+  /// The options of deduplication.
+  DedupOptions options_;
+
+  /// Files to be examined.
+  std::vector<std::string> filenames_;
+};
+
+#endif // !PSF_DEDUP_HPP_
@@ -2,9 +2,21 @@
 /// PSFFile class implementation.
 
 #include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 #include <algorithm>
 #include <string>
+#include <vector>
 #include <unordered_map>
 #include <fstream>
 #include <sstream>
@@ -12,6 +24,7 @@
 
 #include "byteio.hpp"
 #include "psf_file.hpp"
+#include "probes.h"
 #include "cpath.h"
 
 namespace {
@@ -28,6 +41,92 @@ constexpr auto kPSFTagMarker = "[TAG]";
 /// The length of the PSF tag marker
 constexpr auto kPSFTagMarkerSize = 5;
 
+/// The maximum size of files read by the fast path.
+constexpr size_t kPSFSmallFileSize = 64 * 1024;
+
+/// Reads from a file descriptor.
+/// @param fd the file descriptor.
+/// @param data the buffer.
+/// @param size the size of the buffer.
+/// @return the number of bytes read, 0 at the end of the file, or -1 on error.
+long long read_fd(int fd, char * data, size_t size) {
+#ifdef _WIN32
+  return _read(fd, data, static_cast<unsigned int>(std::min<size_t>(size, INT_MAX)));
+#else
+  return read(fd, data, size);
+#endif
+}
+
+/// Read a file, by a single read into the buffer of the thread if it is small.
+/// @param filename path of the file.
+/// @param large_file the buffer receiving the file if it is not small.
+/// @param size the size of the file.
+/// @return the content of the file, in the buffer of the thread (valid until
+/// the next call on the thread) or large_file, or nullptr if the file
+/// cannot be opened.
+///
+/// @remarks A short read of a regular file is taken as the end of the file.
+const char * read_psf_file(const std::string & filename, std::string & large_file, size_t & size) {
+  static thread_local std::vector<char> buffer(kPSFSmallFileSize + 1);
+
+#ifdef _WIN32
+  int fd = _open(filename.c_str(), _O_RDONLY | _O_BINARY);
+#else
+  int fd = open(filename.c_str(), O_RDONLY);
+#endif
+  if (fd == -1) {
+    return nullptr;
+  }
+
+  // request one more byte to tell whether the file is larger
+  long long bytes_read = read_fd(fd, buffer.data(), buffer.size());
+  if (bytes_read >= 0 && static_cast<size_t>(bytes_read) <= kPSFSmallFileSize) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+    size = static_cast<size_t>(bytes_read);
+    return buffer.data();
+  }
+
+  // read the rest of a larger file from the same descriptor
+#ifdef _WIN32
+  struct _stat64 st;
+  bool has_size = bytes_read > 0 && _fstat64(fd, &st) == 0;
+#else
+  struct stat st;
+  bool has_size = bytes_read > 0 && fstat(fd, &st) == 0;
+#endif
+  size_t filled = 0;
+  if (has_size) {
+    large_file.resize(std::max(static_cast<size_t>(st.st_size), static_cast<size_t>(bytes_read)));
+    memcpy(&large_file[0], buffer.data(), static_cast<size_t>(bytes_read));
+    filled = static_cast<size_t>(bytes_read);
+    while (filled < large_file.size()) {
+      bytes_read = read_fd(fd, &large_file[filled], large_file.size() - filled);
+      if (bytes_read <= 0) {
+        break;
+      }
+      filled += static_cast<size_t>(bytes_read);
+    }
+  }
+#ifdef _WIN32
+  _close(fd);
+#else
+  close(fd);
+#endif
+
+  if (!has_size || bytes_read < 0) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Unable to read the file.";
+    throw std::runtime_error(message_buffer.str());
+  }
+  large_file.resize(filled);
+  size = filled;
+  return large_file.data();
+}
+
 } // namespace
 
 /// Constructs a new PSFFile.
@@ -37,68 +136,79 @@ PSFFile::PSFFile() :
 
 /// Open Portable Sound Format from a file.
 PSFFile::PSFFile(const std::string & filename) {
-  // get input file size
-  off_t filesize = path_getfilesize(filename.c_str());
-  if (filesize == -1) {
+  PROBE_DECLARE_TIMESTAMP(open_start);
+
+  // most of mini2sf files are read at once by the fast path
+  std::string large_file;
+  size_t psf_size;
+  const char * psf_data = read_psf_file(filename, large_file, psf_size);
+  if (psf_data == nullptr) {
     std::ostringstream message_buffer;
     message_buffer << filename << ": " << "File not exists.";
     throw std::runtime_error(message_buffer.str());
   }
-  std::uintmax_t psf_size = static_cast<std::uintmax_t>(filesize);
 
-  // open input file
-  std::ifstream in;
-  in.exceptions(std::ios::badbit);
-  in.open(filename, std::ios::binary);
+  parse(psf_data, psf_size, filename);
+  PROBE_PSF_OPEN(filename.c_str(), psf_size, probe_timestamp() - open_start);
+}
 
+/// Open Portable Sound Format from the content of a file in memory.
+PSFFile::PSFFile(const char * data, size_t size, const std::string & filename) {
+  parse(data, size, filename);
+}
+
+/// Parse Portable Sound Format from the content of a file.
+void PSFFile::parse(const char * data, size_t psf_size, const std::string & filename) {
   // check signature
-  std::string signature(kPSFSignatureSize, 0);
-  in.read(&signature[0], kPSFSignatureSize);
-  if (in.gcount() != kPSFSignatureSize) {
+  if (psf_size < kPSFSignatureSize) {
     std::ostringstream message_buffer;
     message_buffer << filename << ": " << "Unable to read the PSF signature.";
     throw std::runtime_error(message_buffer.str());
   }
-  if (signature != kPSFSignature) {
+  if (memcmp(data, kPSFSignature, kPSFSignatureSize) != 0) {
     std::ostringstream message_buffer;
     message_buffer << filename << ": " << "Invalid PSF signature. ";
     throw std::runtime_error(message_buffer.str());
   }
 
   // read the version byte
-  uint8_t version;
-  if (!ReadStreamAsInt8(in, version)) {
+  if (psf_size < 0x04) {
     std::ostringstream message_buffer;
     message_buffer << filename << ": " << "Unable to read the version byte.";
     throw std::runtime_error(message_buffer.str());
   }
+  uint8_t version;
+  ReadInt8(data + 0x03, version);
 
   // read the size of reserved area
-  uint32_t reserved_size;
-  if (!ReadStreamAsInt32L(in, reserved_size)) {
+  if (psf_size < 0x08) {
     std::ostringstream message_buffer;
     message_buffer << filename << ": " << "Unable to read the size of reserved area.";
     throw std::runtime_error(message_buffer.str());
   }
+  uint32_t reserved_size;
+  ReadInt32L(data + 0x04, reserved_size);
 
   // read the size of compressed program
-  uint32_t compressed_exe_size;
-  if (!ReadStreamAsInt32L(in, compressed_exe_size)) {
+  if (psf_size < 0x0c) {
     std::ostringstream message_buffer;
     message_buffer << filename << ": " << "Unable to read the size of compressed program.";
     throw std::runtime_error(message_buffer.str());
   }
+  uint32_t compressed_exe_size;
+  ReadInt32L(data + 0x08, compressed_exe_size);
 
   // crc32 of compressed program
-  uint32_t compressed_exe_crc32;
-  if (!ReadStreamAsInt32L(in, compressed_exe_crc32)) {
+  if (psf_size < 0x10) {
     std::ostringstream message_buffer;
     message_buffer << filename << ": " << "Unable to read the CRC32 of compressed program.";
     throw std::runtime_error(message_buffer.str());
   }
+  uint32_t compressed_exe_crc32;
+  ReadInt32L(data + 0x0c, compressed_exe_crc32);
 
   // check the size consistency
-  size_t psf_mandatory_size = 0x10 + reserved_size + compressed_exe_size;
+  size_t psf_mandatory_size = 0x10 + static_cast<size_t>(reserved_size) + compressed_exe_size;
   if (psf_mandatory_size > psf_size) {
     std::ostringstream message_buffer;
     message_buffer << filename << ": " << "File is too short than expected.";
@@ -109,40 +219,20 @@ PSFFile::PSFFile(const std::string & filename) {
   set_version(version);
 
   // read the reserved area
-  reserved().resize(reserved_size);
-  in.read(&reserved()[0], reserved_size);
-  if (in.gcount() != reserved_size) {
-    std::ostringstream message_buffer;
-    message_buffer << filename << ": " << "Unable to read the reserved area.";
-    throw std::runtime_error(message_buffer.str());
-  }
+  reserved().assign(data + 0x10, reserved_size);
 
   // read the compressed program
-  compressed_exe().resize(compressed_exe_size);
-  in.read(&compressed_exe()[0], compressed_exe_size);
-  if (in.gcount() != compressed_exe_size) {
-    std::ostringstream message_buffer;
-    message_buffer << filename << ": " << "Unable to read the compressed program.";
-    throw std::runtime_error(message_buffer.str());
-  }
+  compressed_exe().assign(data + 0x10 + reserved_size, compressed_exe_size);
 
   // set the CRC32 of the compressed program
   set_compressed_exe_crc32(compressed_exe_crc32);
 
   // check the tag marker (optional area)
   if (psf_mandatory_size + kPSFTagMarkerSize <= psf_size) {
-    std::string tag_marker(kPSFTagMarkerSize, 0);
-    in.read(&tag_marker[0], kPSFTagMarkerSize);
-    if (in.gcount() == kPSFTagMarkerSize && tag_marker == kPSFTagMarker) {
+    if (memcmp(data + psf_mandatory_size, kPSFTagMarker, kPSFTagMarkerSize) == 0) {
       // read entire of the tag area
-      size_t tag_size = (size_t)psf_size - (0x10 + reserved_size + compressed_exe_size + kPSFTagMarkerSize);
-      std::string tag_string(tag_size, 0);
-      in.read(&tag_string[0], tag_size);
-      if (in.gcount() != tag_size) {
-        std::ostringstream message_buffer;
-        message_buffer << filename << ": " << "Unable to read the tag area.";
-        throw std::runtime_error(message_buffer.str());
-      }
+      size_t tag_offset = psf_mandatory_size + kPSFTagMarkerSize;
+      std::string tag_string(data + tag_offset, psf_size - tag_offset);
 
       // Parse tag section. Details are available here:
       // http://wiki.neillcorlett.com/PSFTagFormat
@@ -311,6 +401,34 @@ void PSFFile::write(const std::string & filename) const {
   out.write(compressed_exe().data(), compressed_exe().size());
 
   // write tags if available
+  write_tag_area(out);
+
+  // report a failure to flush, rather than ignoring it in the destructor
+  out.close();
+}
+
+void PSFFile::write_tags(const std::string & filename) const {
+  // open the existing file
+  std::fstream out;
+  out.exceptions(std::ios::badbit | std::ios::failbit);
+  out.open(filename, std::ios::in | std::ios::out | std::ios::binary);
+
+  // overwrite the tag area after the compressed program
+  std::streamoff tag_offset = 0x10 + reserved().size() + compressed_exe().size();
+  out.seekp(tag_offset);
+  write_tag_area(out);
+  std::streamoff file_size = out.tellp();
+  out.close();
+
+  // drop the remaining of the old tags
+  if (path_truncate(filename.c_str(), static_cast<off_t>(file_size)) != 0) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Unable to truncate the file.";
+    throw std::runtime_error(message_buffer.str());
+  }
+}
+
+void PSFFile::write_tag_area(std::ostream & out) const {
   if (!tags().empty())
   {
     // write the tag marker
@@ -325,7 +443,7 @@ void PSFFile::write(const std::string & filename) const {
       std::istringstream value_reader(value);
       std::string line;
       while (std::getline(value_reader, line)) {
-        out << key << "=" << value << "\n";
+        out << key << "=" << line << "\n";
       }
     }
   }
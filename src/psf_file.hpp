@@ -8,6 +8,7 @@
 
 #include <string>
 #include <memory>
+#include <ostream>
 #include <unordered_map>
 
 /// The PSFFile class represents a Portable Sound Format file.
@@ -26,6 +27,15 @@ public:
   /// @remarks This function does not load any associated psflibs.
   explicit PSFFile(const std::string & filename);
 
+  /// Open Portable Sound Format from the content of a file in memory.
+  /// @param data the content of the file.
+  /// @param size the size of the content.
+  /// @param filename the name of the file for error messages.
+  ///
+  /// @remarks This function does not check the validity of CRC32 fields.
+  /// @remarks This function does not load any associated psflibs.
+  PSFFile(const char * data, size_t size, const std::string & filename);
+
   /// Constructs a new copy of specified PSFFile.
   /// @param origin a PSFFile object.
   PSFFile(const PSFFile & origin) = default;
@@ -103,7 +113,24 @@ public:
   /// @remarks This function does not check the validity of CRC32 fields.
   void write(const std::string & filename) const;
 
+  /// Rewrite the tags of an existing PSF file in place.
+  /// @param filename path of the file.
+  ///
+  /// @remarks The file must have the same reserved area and compressed
+  /// program as this object, which are left untouched.
+  void write_tags(const std::string & filename) const;
+
 private:
+  /// Parse Portable Sound Format from the content of a file.
+  /// @param data the content of the file.
+  /// @param psf_size the size of the file.
+  /// @param filename path of the file, used in error messages.
+  void parse(const char * data, size_t psf_size, const std::string & filename);
+
+  /// Write the tag area.
+  /// @param out the output stream, at the end of the compressed program.
+  void write_tag_area(std::ostream & out) const;
+
   /// Version byte.
   ///
   /// The version byte is used to determine the type of PSF file.
@@ -0,0 +1,165 @@
+/// @file
+/// PSFVerifier class implementation.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#ifdef __linux__
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#endif
+
+#include "psf_file.hpp"
+#include "psf_verifier.hpp"
+
+namespace {
+
+/// The version byte of 2SF.
+constexpr uint8_t kPSFVersion2SF = 0x24;
+
+/// The size of the buffer receiving the decompressed program.
+constexpr size_t kPSFVerifierBufferSize = 64 * 1024;
+
+/// The maximum size of a stamp.
+constexpr size_t kPSFVerifierMaxStampSize = 256;
+
+/// Decompresses a program entirely, and returns its size.
+/// @param filename the path to PSF file, for error messages.
+/// @param compressed_exe the compressed program.
+/// @param header the buffer receiving the first 8 bytes of the program.
+/// @return the size of the decompressed program.
+uint64_t inflate_all(const std::string & filename, const std::string & compressed_exe, uint8_t * header) {
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  if (inflateInit(&z) != Z_OK) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Unable to initialize zlib.";
+    throw std::runtime_error(message_buffer.str());
+  }
+
+  std::vector<Bytef> buffer(kPSFVerifierBufferSize);
+  z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(compressed_exe.data()));
+  z.avail_in = static_cast<uInt>(compressed_exe.size());
+  uint64_t total = 0;
+  int result;
+  do {
+    z.next_out = buffer.data();
+    z.avail_out = static_cast<uInt>(buffer.size());
+    result = inflate(&z, Z_NO_FLUSH);
+
+    size_t produced = buffer.size() - z.avail_out;
+    for (size_t i = 0; i < produced && total + i < 8; i++) {
+      header[total + i] = buffer[i];
+    }
+    total += produced;
+  } while (result == Z_OK);
+  uInt trailing_size = z.avail_in;
+  inflateEnd(&z);
+
+  // running out of input before the end is a truncated stream
+  if (result != Z_STREAM_END) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Program data is corrupted (" <<
+      (result == Z_BUF_ERROR ? "truncated stream" : "invalid stream") << ").";
+    throw std::runtime_error(message_buffer.str());
+  }
+
+  // the program must be the stream alone
+  if (trailing_size != 0) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Program data is corrupted (" << trailing_size <<
+      " bytes after the end of stream).";
+    throw std::runtime_error(message_buffer.str());
+  }
+  return total;
+}
+
+#ifdef __linux__
+/// Makes the stamp of a file.
+/// @param tool_version the version of the tool.
+/// @param st the status of the file.
+/// @param crc32 the CRC32 of the compressed program, omitted if negative.
+/// @return the stamp.
+std::string make_stamp(const std::string & tool_version, const struct stat & st, int64_t crc32) {
+  char stamp[kPSFVerifierMaxStampSize];
+  int length = snprintf(stamp, sizeof(stamp), "2sf2rom/%s size=%lld mtime=%lld.%09ld",
+    tool_version.c_str(), static_cast<long long>(st.st_size), static_cast<long long>(st.st_mtim.tv_sec),
+    static_cast<long>(st.st_mtim.tv_nsec));
+  if (crc32 >= 0 && length > 0 && static_cast<size_t>(length) < sizeof(stamp)) {
+    snprintf(stamp + length, sizeof(stamp) - length, " crc=%08x zlib=ok", static_cast<unsigned int>(crc32));
+  }
+  return stamp;
+}
+#endif
+
+} // namespace
+
+/// Constructs a new PSFVerifier.
+PSFVerifier::PSFVerifier(const std::string & tool_version, bool use_stamps) :
+    tool_version_(tool_version),
+    use_stamps_(use_stamps) {
+}
+
+/// Verifies a file.
+PSFVerifierResult PSFVerifier::verify(const std::string & filename) const {
+#ifdef __linux__
+  // the stamp is taken from the status before reading, so a file modified
+  // during the verification is verified again next time
+  struct stat st;
+  bool stamp_available = use_stamps_ && stat(filename.c_str(), &st) == 0;
+  if (stamp_available) {
+    char stamp[kPSFVerifierMaxStampSize];
+    ssize_t length = getxattr(filename.c_str(), kPSFVerifierStampName, stamp, sizeof(stamp));
+    if (length > 0) {
+      std::string expected_prefix = make_stamp(tool_version_, st, -1) + " crc=";
+      std::string actual(stamp, static_cast<size_t>(length));
+      if (actual.compare(0, expected_prefix.size(), expected_prefix) == 0 &&
+          actual.size() >= 8 && actual.compare(actual.size() - 8, 8, " zlib=ok") == 0) {
+        return PSFVerifierResult::kStamped;
+      }
+    }
+  }
+#endif
+
+  PSFFile psf(filename);
+
+  // check CRC32 of the compressed program
+  uint32_t actual_crc32 = ::crc32(0L, reinterpret_cast<const Bytef *>(psf.compressed_exe().data()),
+    static_cast<uInt>(psf.compressed_exe().size()));
+  if (psf.compressed_exe_crc32() != actual_crc32) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "CRC32 error at the compressed program.";
+    throw std::runtime_error(message_buffer.str());
+  }
+
+  // check the zlib stream, and the program header of 2SF
+  if (!psf.compressed_exe().empty()) {
+    uint8_t header[8] = {};
+    uint64_t size = inflate_all(filename, psf.compressed_exe(), header);
+    if (psf.version() == kPSFVersion2SF) {
+      uint32_t load_size = header[4] | (header[5] << 8) | (header[6] << 16) | (static_cast<uint32_t>(header[7]) << 24);
+      if (size < 8 || size - 8 != load_size) {
+        std::ostringstream message_buffer;
+        message_buffer << filename << ": " << "Program size does not match the program header.";
+        throw std::runtime_error(message_buffer.str());
+      }
+    }
+  }
+
+#ifdef __linux__
+  // a file system without extended attributes just misses the shortcut
+  if (stamp_available) {
+    std::string stamp = make_stamp(tool_version_, st, actual_crc32);
+    setxattr(filename.c_str(), kPSFVerifierStampName, stamp.data(), stamp.size(), 0);
+  }
+#endif
+  return PSFVerifierResult::kVerified;
+}
@@ -0,0 +1,55 @@
+/// @file
+/// PSFVerifier class header.
+
+#ifndef PSF_VERIFIER_HPP_
+#define PSF_VERIFIER_HPP_
+
+#include <string>
+
+/// The name of the extended attribute holding the verification stamp.
+constexpr auto kPSFVerifierStampName = "user.2sf2rom.verified";
+
+/// The PSFVerifierResult enum represents how a file has been verified.
+enum class PSFVerifierResult {
+  /// The file has been verified entirely.
+  kVerified,
+
+  /// The file has been verified before and is unchanged since then.
+  kStamped,
+};
+
+/// The PSFVerifier class verifies PSF files, and optionally records the
+/// verification in an extended attribute of each file.
+///
+/// A file is valid if it is parsed as PSF, the CRC32 of the compressed
+/// program matches the header, and the program is a complete zlib stream.
+/// For 2SF files, the size of the program must also match its header.
+///
+/// The stamp holds the tool version, the file size and mtime, and the
+/// verified CRC32. A file whose stamp matches its current size and mtime is
+/// not read at all, so verifying an unchanged collection costs one stat and
+/// one getxattr per file. Stamps are supported on Linux only.
+class PSFVerifier {
+public:
+  /// Constructs a new PSFVerifier.
+  /// @param tool_version the version of the tool written in stamps, so that
+  /// a new version verifies the files again.
+  /// @param use_stamps true to skip the files having a matching stamp, and
+  /// to stamp the files verified.
+  PSFVerifier(const std::string & tool_version, bool use_stamps);
+
+  /// Verifies a file.
+  /// @param filename the path to PSF file.
+  /// @return how the file has been verified.
+  /// @throw std::runtime_error if the file is invalid.
+  PSFVerifierResult verify(const std::string & filename) const;
+
+private:
+  /// The version of the tool.
+  std::string tool_version_;
+
+  /// True to use the stamps.
+  bool use_stamps_;
+};
+
+#endif // !PSF_VERIFIER_HPP_
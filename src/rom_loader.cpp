@@ -0,0 +1,293 @@
+/// @file
+/// 2SF to ROM loader implementation.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <exception>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "rom_loader.hpp"
+#include "arena.hpp"
+#include "parallel.hpp"
+#include "path_cache.hpp"
+#include "probes.h"
+#include "psf_file.hpp"
+#include "ZlibReader.h"
+#include "cpath.h"
+
+namespace {
+
+/// Resolve the programs of a 2SF file and its psflibs recursively.
+/// @param filename the path to 2sf file.
+/// @param programs the programs to be appended, in the order of loading.
+/// @param lib_nest_level the nest level of psflib.
+/// @param path_cache the cache of the batch, nullptr for none.
+void resolve_2sf(const std::string & filename, std::vector<PSFProgram> & programs, int lib_nest_level,
+    PathCache * path_cache) {
+  // check the psflib nest level
+  if (lib_nest_level >= kPSFLibMaxNestLevel) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Nest level error on psflib loading.";
+    throw std::out_of_range(message_buffer.str());
+  }
+
+  // get the absolute path
+  char absolute_path[PATH_MAX];
+  if (path_cache != nullptr) {
+    bool exists;
+    std::string resolved_path = path_cache->resolve(filename, exists);
+    if (!exists) {
+      std::ostringstream message_buffer;
+      message_buffer << filename << ": " << "File not exists.";
+      throw std::runtime_error(message_buffer.str());
+    }
+    if (resolved_path.empty() || resolved_path.size() >= sizeof(absolute_path)) {
+      std::ostringstream message_buffer;
+      message_buffer << filename << ": " << "Unable to determine absolute path.";
+      throw std::out_of_range(message_buffer.str());
+    }
+    strcpy(absolute_path, resolved_path.c_str());
+  }
+  else if (path_getabspath(filename.c_str(), absolute_path) == NULL) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Unable to determine absolute path.";
+    throw std::out_of_range(message_buffer.str());
+  }
+
+  // get the directory path
+  char basedir[PATH_MAX];
+  strcpy(basedir, absolute_path);
+  path_dirname(basedir);
+
+  // load the psf file, unless the psflib has been loaded for another file
+  PSFProgram program;
+  if (lib_nest_level == 0 || path_cache == nullptr || !path_cache->find_program(absolute_path, program)) {
+    program.filename = absolute_path;
+    program.psf = PSFFile(filename);
+    validate_program(program, filename);
+
+    if (lib_nest_level != 0 && path_cache != nullptr) {
+      path_cache->add_program(program);
+    }
+  }
+  const PSFFile & psf = program.psf;
+
+  // load psflibs
+  int lib_index = 1;
+  while (true) {
+    // search for _libN tag (the name fits in the small string buffer)
+    char lib_tag_name[16];
+    if (lib_index > 1) {
+      snprintf(lib_tag_name, sizeof(lib_tag_name), "_lib%d", lib_index);
+    }
+    else {
+      strcpy(lib_tag_name, "_lib");
+    }
+
+    // if no tag is present, end the lib loading
+    auto lib_tag = psf.tags().find(lib_tag_name);
+    if (lib_tag == psf.tags().end()) {
+      break;
+    }
+
+    // the lib path is relative to the parent psf directory
+    // (the current directory is left untouched, so that files can be loaded
+    // from multiple threads)
+    std::string lib_filename = lib_tag->second;
+    if (!path_isabs(lib_filename.c_str())) {
+      lib_filename = std::string(basedir) + PATH_SEPARATOR_STR + lib_filename;
+    }
+
+    // load the lib
+    PROBE_LIB_RESOLVE(absolute_path, lib_filename.c_str(), lib_nest_level + 1);
+    resolve_2sf(lib_filename, programs, lib_nest_level + 1, path_cache);
+
+    // check the next lib
+    lib_index++;
+  }
+
+  // check the rom buffer size
+  uint64_t load_end = static_cast<uint64_t>(program.load_offset) + program.load_size;
+  if (!programs.empty() && load_end > get_rom_size(programs)) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Load offset/size of 2SF is out of bound.";
+    throw std::out_of_range(message_buffer.str());
+  }
+
+  programs.push_back(std::move(program));
+}
+
+} // namespace
+
+/// Check the CRC32 of a program, and read its header.
+void validate_program(PSFProgram & program, const std::string & filename) {
+  const PSFFile & psf = program.psf;
+
+  // check CRC32 of the compressed program
+  uint32_t actual_crc32 = ::crc32(0L, reinterpret_cast<const Bytef *>(
+    psf.compressed_exe().data()), static_cast<uInt>(psf.compressed_exe().size()));
+  PROBE_CRC_VERIFY(program.filename.c_str(), psf.compressed_exe().size(), psf.compressed_exe_crc32() == actual_crc32);
+  if (psf.compressed_exe_crc32() != actual_crc32) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "CRC32 error at the compressed program.";
+    throw std::runtime_error(message_buffer.str());
+  }
+
+  // read the exe header
+  // - 4 bytes offset
+  // - 4 bytes size
+  bool read_success = true;
+  {
+    ArenaScope arena_scope(Arena::thread_arena());
+    ZlibReader compressed_exe(psf.compressed_exe().data(), psf.compressed_exe().size(), false,
+      Arena::zalloc, Arena::zfree, &Arena::thread_arena());
+    read_success &= compressed_exe.readInt(program.load_offset);
+    read_success &= compressed_exe.readInt(program.load_size);
+  }
+  if (!read_success) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Unable to read the program header.";
+    throw std::runtime_error(message_buffer.str());
+  }
+
+  // check the rom buffer size
+  uint64_t load_end = static_cast<uint64_t>(program.load_offset) + program.load_size;
+  if (load_end > kNDSRomMaxSize) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Load offset/size of 2SF is too large. ";
+    throw std::out_of_range(message_buffer.str());
+  }
+}
+
+/// Resolve the programs of a 2SF file and its psflibs.
+std::vector<PSFProgram> resolve_2sf(const std::string & filename) {
+  std::vector<PSFProgram> programs;
+  resolve_2sf(filename, programs, 0, nullptr);
+  return programs;
+}
+
+/// Resolve 2SF files and group them by their psflibs.
+std::vector<PSFLibSet> resolve_2sf_sets(const std::vector<std::string> & filenames,
+    const std::function<void(size_t, const std::exception &)> & on_error, unsigned int thread_count) {
+  // read the files in parallel, which is mostly waiting for I/O
+  // (the directories and psflibs shared by the files are looked up once)
+  PathCache path_cache;
+  std::vector<std::vector<PSFProgram>> resolved_programs(filenames.size());
+  std::vector<std::exception_ptr> errors(filenames.size());
+  parallel_for(filenames.size(), thread_count, [&](size_t file_index) {
+    try {
+      resolve_2sf(filenames[file_index], resolved_programs[file_index], 0, &path_cache);
+    }
+    catch (...) {
+      errors[file_index] = std::current_exception();
+    }
+  });
+
+  // the key of the set is made from the paths of psflibs
+  std::map<std::string, PSFLibSet> lib_sets;
+  for (size_t file_index = 0; file_index < filenames.size(); file_index++) {
+    try {
+      if (errors[file_index]) {
+        std::rethrow_exception(errors[file_index]);
+      }
+
+      std::vector<PSFProgram> & programs = resolved_programs[file_index];
+      PSFProgram program = std::move(programs.back());
+      programs.pop_back();
+
+      std::string lib_set_key;
+      for (const PSFProgram & lib_program : programs) {
+        lib_set_key += lib_program.filename;
+        lib_set_key += '\n';
+      }
+
+      PSFLibSet & lib_set = lib_sets[lib_set_key];
+      if (lib_set.file_indices.empty()) {
+        lib_set.lib_programs = std::move(programs);
+      }
+      lib_set.file_indices.push_back(file_index);
+      lib_set.programs.push_back(std::move(program));
+    }
+    catch (std::exception & ex) {
+      on_error(file_index, ex);
+    }
+  }
+
+  std::vector<PSFLibSet> result;
+  for (auto & pair : lib_sets) {
+    result.push_back(std::move(pair.second));
+  }
+  return result;
+}
+
+/// Returns the ROM size of resolved programs.
+size_t get_rom_size(const std::vector<PSFProgram> & programs) {
+  if (programs.empty()) {
+    return 0;
+  }
+
+  // the first loaded program determines the ROM size
+  const PSFProgram & first_program = programs.front();
+  return static_cast<size_t>(first_program.load_offset) + first_program.load_size;
+}
+
+/// Decompress a program.
+void inflate_program(const PSFProgram & program, char * data, const InflateProgressCallback & progress) {
+  const PSFFile & psf = program.psf;
+
+  // the inflate state is taken from the arena of the thread, and the
+  // compressed program is read without a copy
+  ArenaScope arena_scope(Arena::thread_arena());
+  ZlibReader compressed_exe(psf.compressed_exe().data(), psf.compressed_exe().size(), false,
+    Arena::zalloc, Arena::zfree, &Arena::thread_arena());
+
+  // skip the exe header
+  uint32_t load_offset;
+  uint32_t load_size;
+  compressed_exe.readInt(load_offset);
+  compressed_exe.readInt(load_size);
+
+  // report the progress of the program area, excluding the exe header
+  if (progress) {
+    size_t header_size = compressed_exe.position();
+    compressed_exe.set_progress_callback([&progress, header_size](size_t position) {
+      return progress(position - header_size);
+    });
+  }
+
+  // decompress the program area
+  PROBE_INFLATE_START(program.filename.c_str(), program.load_offset, program.load_size);
+  PROBE_DECLARE_TIMESTAMP(inflate_start);
+  int bytes_read = compressed_exe.read(data, program.load_size);
+  PROBE_INFLATE_END(program.filename.c_str(), bytes_read, probe_timestamp() - inflate_start);
+  if (compressed_exe.cancelled()) {
+    std::ostringstream message_buffer;
+    message_buffer << program.filename << ": " << "Loading cancelled.";
+    throw LoadCancelledError(message_buffer.str());
+  }
+  if (bytes_read != static_cast<int>(program.load_size)) {
+    std::ostringstream message_buffer;
+    message_buffer << program.filename << ": " << "Failed to deflate data. Program data is corrupted.";
+    throw std::out_of_range(message_buffer.str());
+  }
+}
+
+/// Load ROM image from 2SF file.
+void load_2sf(const std::string & filename, std::vector<char> & rom) {
+  std::vector<PSFProgram> programs = resolve_2sf(filename);
+
+  rom.assign(get_rom_size(programs), 0);
+  for (const PSFProgram & program : programs) {
+    inflate_program(program, rom.data() + program.load_offset);
+  }
+}
@@ -0,0 +1,111 @@
+/// @file
+/// 2SF to ROM loader header.
+
+#ifndef ROM_LOADER_HPP_
+#define ROM_LOADER_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+
+#include "psf_file.hpp"
+
+/// The maximum ROM size of NDS.
+constexpr size_t kNDSRomMaxSize = 128 * 1024 * 1024;
+
+/// The maximum nest level of psflib.
+constexpr int kPSFLibMaxNestLevel = 10;
+
+/// The function called with the number of bytes decompressed so far,
+/// which returns false to cancel the decompression.
+typedef std::function<bool(size_t)> InflateProgressCallback;
+
+/// The LoadCancelledError class represents the cancellation of loading.
+class LoadCancelledError : public std::runtime_error {
+public:
+  /// Constructs a new LoadCancelledError.
+  /// @param message the error message.
+  explicit LoadCancelledError(const std::string & message) :
+      std::runtime_error(message) {
+  }
+};
+
+/// The PSFProgram struct represents a program area of a 2SF file,
+/// which is one layer of the ROM image.
+struct PSFProgram {
+  /// Absolute path of the 2SF file.
+  std::string filename;
+
+  /// The 2SF file.
+  PSFFile psf;
+
+  /// Offset of the program in the ROM image.
+  uint32_t load_offset;
+
+  /// Size of the program.
+  uint32_t load_size;
+};
+
+/// The PSFLibSet struct represents 2SF files sharing the same psflibs.
+struct PSFLibSet {
+  /// The psflib programs in the order of loading.
+  ///
+  /// Empty for the set of files without psflibs.
+  std::vector<PSFProgram> lib_programs;
+
+  /// The indices of the files in the list given to resolve_2sf_sets.
+  std::vector<size_t> file_indices;
+
+  /// The programs of the files themselves.
+  std::vector<PSFProgram> programs;
+};
+
+/// Check the CRC32 of a program, and read its header.
+/// @param program the program whose filename and psf are set, to be filled
+/// with load_offset and load_size.
+/// @param filename the name of the file for error messages.
+void validate_program(PSFProgram & program, const std::string & filename);
+
+/// Resolve the programs of a 2SF file and its psflibs.
+/// @param filename the path to 2sf file.
+/// @return the programs in the order of loading.
+///
+/// @remarks The first program determines the ROM size, the last program is
+/// the one of the specified file.
+std::vector<PSFProgram> resolve_2sf(const std::string & filename);
+
+/// Resolve 2SF files and group them by their psflibs.
+/// @param filenames the paths to 2sf files.
+/// @param on_error the function called with the file index and the error,
+/// for each file which failed to be resolved.
+/// @param thread_count the number of threads reading the files, 0 for the
+/// default.
+/// @return the sets of files sharing the same psflibs.
+///
+/// @remarks on_error is called on the calling thread, in the order of files.
+std::vector<PSFLibSet> resolve_2sf_sets(const std::vector<std::string> & filenames,
+  const std::function<void(size_t, const std::exception &)> & on_error, unsigned int thread_count = 1);
+
+/// Returns the ROM size of resolved programs.
+/// @param programs the programs in the order of loading.
+/// @return the ROM size.
+size_t get_rom_size(const std::vector<PSFProgram> & programs);
+
+/// Decompress a program.
+/// @param program the program to be decompressed.
+/// @param data the buffer of load_size bytes, which is usually the ROM image
+/// at load_offset.
+/// @param progress the function called periodically during decompression.
+/// @throw LoadCancelledError if the progress function returns false.
+void inflate_program(const PSFProgram & program, char * data,
+  const InflateProgressCallback & progress = nullptr);
+
+/// Load ROM image from 2SF file.
+/// @param filename the path to 2sf file.
+/// @param rom the rom image to be loaded.
+void load_2sf(const std::string & filename, std::vector<char> & rom);
+
+#endif // !ROM_LOADER_HPP_
@@ -0,0 +1,109 @@
+/// @file
+/// RomOverlay class implementation.
+
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "rom_loader.hpp"
+#include "rom_overlay.hpp"
+
+constexpr size_t RomOverlay::kNoLayer;
+
+/// Constructs a new RomOverlay.
+RomOverlay::RomOverlay(const std::string & filename) :
+    size_(0) {
+  build(resolve_2sf(filename));
+}
+
+/// Constructs a new RomOverlay.
+RomOverlay::RomOverlay(const std::vector<PSFProgram> & programs) :
+    size_(0) {
+  build(programs);
+}
+
+/// Reads a range of the ROM image.
+void RomOverlay::read(size_t offset, char * dst, size_t size) const {
+  if (offset > size_ || size > size_ - offset) {
+    std::ostringstream message_buffer;
+    message_buffer << "Read out of the ROM image (offset " << offset << ", size " << size << ").";
+    throw std::out_of_range(message_buffer.str());
+  }
+
+  // find the segment containing the offset, then walk forward
+  auto it = std::upper_bound(segments_.begin(), segments_.end(), offset,
+    [](size_t value, const Segment & segment) { return value < segment.end; });
+  size_t end = offset + size;
+  for (; offset < end; ++it) {
+    size_t length = std::min(end, it->end) - offset;
+    if (it->layer == kNoLayer) {
+      memset(dst, 0, length);
+    }
+    else {
+      const Layer & layer = layers_[it->layer];
+      memcpy(dst, get_layer_data(layer) + (offset - layer.offset), length);
+    }
+    dst += length;
+    offset += length;
+  }
+}
+
+/// Composes the flat ROM image.
+void RomOverlay::materialize(std::vector<char> & rom) const {
+  rom.resize(size_);
+  read(0, rom.data(), size_);
+}
+
+/// Returns the decompressed program of a layer.
+const char * RomOverlay::get_layer_data(const Layer & layer) const {
+  // a failed decompression throws out of call_once, and is retried next time
+  std::call_once(*layer.inflated, [&layer]() {
+    layer.data.resize(layer.program.load_size);
+    inflate_program(layer.program, layer.data.data());
+    layer.program.psf = PSFFile();
+  });
+  return layer.data.data();
+}
+
+/// Adds the programs as layers, and resolves the segments.
+void RomOverlay::build(const std::vector<PSFProgram> & programs) {
+  size_ = get_rom_size(programs);
+  segments_.clear();
+  if (size_ != 0) {
+    segments_.push_back(Segment{ 0, size_, kNoLayer });
+  }
+
+  for (const PSFProgram & program : programs) {
+    Layer layer;
+    layer.offset = program.load_offset;
+    layer.program = program;
+    layer.inflated.reset(new std::once_flag);
+    layers_.push_back(std::move(layer));
+
+    // cut the segments overlapped by the layer, which is above all of them
+    size_t start = program.load_offset;
+    size_t end = start + program.load_size;
+    if (start >= end) {
+      continue;
+    }
+    std::vector<Segment> segments;
+    for (const Segment & segment : segments_) {
+      if (segment.start < start) {
+        segments.push_back(Segment{ segment.start, std::min(segment.end, start), segment.layer });
+      }
+      if (segment.end > end) {
+        segments.push_back(Segment{ std::max(segment.start, end), segment.end, segment.layer });
+      }
+    }
+    segments.push_back(Segment{ start, end, layers_.size() - 1 });
+    std::sort(segments.begin(), segments.end(),
+      [](const Segment & a, const Segment & b) { return a.start < b.start; });
+    segments_ = std::move(segments);
+  }
+}
@@ -0,0 +1,108 @@
+/// @file
+/// RomOverlay class header.
+
+#ifndef ROM_OVERLAY_HPP_
+#define ROM_OVERLAY_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rom_loader.hpp"
+
+/// The RomOverlay class represents the ROM image of a 2SF file as layers of
+/// decompressed programs, without composing them into a flat image.
+///
+/// Each program is kept as a layer covering [load_offset,
+/// load_offset + load_size). A read of any range of the image is answered by
+/// the top-most (latest loaded) layer covering each byte, or zeros where no
+/// layer covers it, so consumers reading a few regions never pay for a copy
+/// of the whole image.
+///
+/// The programs stay compressed until the first read hitting a range where
+/// they are on top, so layers which are never read, or entirely covered by
+/// later layers, are never decompressed. Reads are safe from multiple
+/// threads.
+class RomOverlay {
+public:
+  /// Constructs a new RomOverlay.
+  /// @param filename the path to 2sf file.
+  explicit RomOverlay(const std::string & filename);
+
+  /// Constructs a new RomOverlay.
+  /// @param programs the programs in the order of loading, as returned by
+  /// resolve_2sf.
+  explicit RomOverlay(const std::vector<PSFProgram> & programs);
+
+  /// Returns the size of the ROM image.
+  /// @return the size in bytes.
+  inline size_t size() const noexcept {
+    return size_;
+  }
+
+  /// Reads a range of the ROM image.
+  /// @param offset the offset in the image.
+  /// @param dst the buffer to be filled.
+  /// @param size the number of bytes to read.
+  void read(size_t offset, char * dst, size_t size) const;
+
+  /// Composes the flat ROM image.
+  /// @param rom the image to be filled.
+  void materialize(std::vector<char> & rom) const;
+
+private:
+  /// The Layer struct represents a program, decompressed on demand.
+  struct Layer {
+    /// Offset of the program in the ROM image.
+    size_t offset;
+
+    /// The program, released once decompressed.
+    mutable PSFProgram program;
+
+    /// The decompressed program, empty until first read.
+    mutable std::vector<char> data;
+
+    /// The flag of the decompression, which runs once among threads.
+    std::unique_ptr<std::once_flag> inflated;
+  };
+
+  /// The Segment struct represents a range of the image resolved to a
+  /// single layer.
+  struct Segment {
+    /// The start offset of the range.
+    size_t start;
+
+    /// The end offset of the range.
+    size_t end;
+
+    /// The index of the top-most layer, kNoLayer if none covers the range.
+    size_t layer;
+  };
+
+  /// The layer index of the ranges not covered by any layer.
+  static constexpr size_t kNoLayer = SIZE_MAX;
+
+  /// Returns the decompressed program of a layer.
+  /// @param layer the layer.
+  /// @return the decompressed program.
+  const char * get_layer_data(const Layer & layer) const;
+
+  /// Adds the programs as layers, and resolves the segments.
+  /// @param programs the programs in the order of loading.
+  void build(const std::vector<PSFProgram> & programs);
+
+  /// The layers in the order of loading.
+  std::vector<Layer> layers_;
+
+  /// The segments covering the whole image in ascending order.
+  std::vector<Segment> segments_;
+
+  /// The size of the ROM image.
+  size_t size_;
+};
+
+#endif // !ROM_OVERLAY_HPP_
@@ -0,0 +1,410 @@
+/// @file
+/// ROM pack file classes implementation.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+
+#include "byteio.hpp"
+#include "rom_pack.hpp"
+#include "rom_loader.hpp"
+
+namespace {
+
+/// The data of file signature.
+constexpr auto kRomPackSignature = "2SFPACK\x1a";
+
+/// The length of file signature.
+constexpr size_t kRomPackSignatureSize = 8;
+
+/// The version of ROM pack.
+constexpr uint32_t kRomPackVersion = 1;
+
+/// The size of the header.
+constexpr size_t kRomPackHeaderSize = 48;
+
+/// The size of a base record.
+constexpr size_t kRomPackBaseRecordSize = 16;
+
+/// The size of an entry record.
+constexpr size_t kRomPackEntryRecordSize = 32;
+
+/// The size of a patch record.
+constexpr size_t kRomPackPatchRecordSize = 16;
+
+/// Unchanged bytes shorter than this length are merged into the patch,
+/// as they cost less than a new patch record.
+constexpr size_t kRomPackPatchMergeGap = kRomPackPatchRecordSize;
+
+/// The BaseRecord struct represents a base image in a ROM pack.
+struct BaseRecord {
+  uint64_t offset;
+  uint64_t size;
+};
+
+/// The EntryRecord struct represents a ROM in a ROM pack.
+struct EntryRecord {
+  std::string name;
+  uint32_t base_index;
+  uint32_t first_patch;
+  uint32_t patch_count;
+  uint64_t rom_size;
+};
+
+/// The PatchRecord struct represents a patch in a ROM pack.
+struct PatchRecord {
+  uint64_t offset;
+  uint32_t rom_offset;
+  uint32_t size;
+};
+
+/// Checks that a range read from a pack lies within the pack.
+/// @param offset the offset of the range.
+/// @param size the size of the range.
+/// @param file_size the size of the pack.
+/// @return true if the range lies within the pack.
+bool is_range_in_file(uint64_t offset, uint64_t size, uint64_t file_size) {
+  // offset + size may wrap around with the values read from a corrupted pack
+  return size <= file_size && offset <= file_size - size;
+}
+
+} // namespace
+
+/// Adds a file to be packed.
+void RomPackWriter::add(const std::string & filename, const std::string & name) {
+  Entry entry;
+  entry.filename = filename;
+  entry.name = name;
+  entries_.push_back(std::move(entry));
+}
+
+/// Writes all added files to a ROM pack.
+int RomPackWriter::write(const std::string & filename) {
+  int failures = 0;
+
+  std::ofstream out;
+  out.exceptions(std::ios::badbit | std::ios::failbit);
+  out.open(filename, std::ios::binary);
+
+  // reserve the header, which is written at last
+  uint64_t offset = kRomPackHeaderSize;
+  out.write(std::string(kRomPackHeaderSize, 0).data(), kRomPackHeaderSize);
+
+  // resolve all files, and group them by their psflibs
+  std::vector<std::string> filenames;
+  for (const Entry & entry : entries_) {
+    filenames.push_back(entry.filename);
+  }
+  std::vector<PSFLibSet> lib_sets = resolve_2sf_sets(filenames,
+    [&failures](size_t, const std::exception & ex) {
+      std::cout << "Error: " << ex.what() << std::endl;
+      failures++;
+    });
+
+  std::vector<BaseRecord> bases;
+  std::vector<EntryRecord> entries;
+  std::vector<PatchRecord> patches;
+  std::set<std::string> names;
+  std::vector<char> base;
+  std::vector<char> program_data;
+  for (const PSFLibSet & lib_set : lib_sets) {
+    uint32_t base_index = kRomPackNoBase;
+    base.clear();
+    for (size_t i = 0; i < lib_set.programs.size(); i++) {
+      const PSFProgram & program = lib_set.programs[i];
+      const Entry & entry = entries_[lib_set.file_indices[i]];
+
+      try {
+        if (names.count(entry.name) != 0) {
+          std::ostringstream message_buffer;
+          message_buffer << entry.filename << ": " << "Duplicated name \"" << entry.name << "\" in the pack.";
+          throw std::invalid_argument(message_buffer.str());
+        }
+
+        // compose and write the base image once for each set
+        if (!lib_set.lib_programs.empty() && base_index == kRomPackNoBase) {
+          base.assign(get_rom_size(lib_set.lib_programs), 0);
+          for (const PSFProgram & lib_program : lib_set.lib_programs) {
+            inflate_program(lib_program, base.data() + lib_program.load_offset);
+          }
+
+          size_t padding_size = static_cast<size_t>((kRomPackAlignment - offset % kRomPackAlignment) % kRomPackAlignment);
+          out.write(std::string(padding_size, 0).data(), padding_size);
+          offset += padding_size;
+
+          BaseRecord base_record;
+          base_record.offset = offset;
+          base_record.size = base.size();
+          out.write(base.data(), base.size());
+          offset += base.size();
+
+          base_index = static_cast<uint32_t>(bases.size());
+          bases.push_back(base_record);
+        }
+
+        // decompress the program, and compare it with the base image
+        program_data.resize(program.load_size);
+        inflate_program(program, program_data.data());
+
+        EntryRecord entry_record;
+        entry_record.name = entry.name;
+        entry_record.base_index = base_index;
+        entry_record.first_patch = static_cast<uint32_t>(patches.size());
+        entry_record.patch_count = 0;
+        entry_record.rom_size = (base_index != kRomPackNoBase) ? base.size() :
+          static_cast<size_t>(program.load_offset) + program.load_size;
+
+        // write the differing ranges as patches
+        // (a ROM without base image is compared with zeros)
+        auto is_changed = [&](size_t position) {
+          char base_byte = (base_index != kRomPackNoBase) ? base[program.load_offset + position] : 0;
+          return program_data[position] != base_byte;
+        };
+        size_t position = 0;
+        while (position < program_data.size()) {
+          if (!is_changed(position)) {
+            position++;
+            continue;
+          }
+
+          size_t patch_start = position;
+          size_t patch_end = position + 1;
+          for (position = patch_end; position < program_data.size() && position - patch_end < kRomPackPatchMergeGap; position++) {
+            if (is_changed(position)) {
+              patch_end = position + 1;
+            }
+          }
+          position = patch_end;
+
+          PatchRecord patch_record;
+          patch_record.offset = offset;
+          patch_record.rom_offset = static_cast<uint32_t>(program.load_offset + patch_start);
+          patch_record.size = static_cast<uint32_t>(patch_end - patch_start);
+          out.write(&program_data[patch_start], patch_record.size);
+          offset += patch_record.size;
+
+          patches.push_back(patch_record);
+          entry_record.patch_count++;
+        }
+
+        names.insert(entry.name);
+        entries.push_back(std::move(entry_record));
+      }
+      catch (std::exception & ex) {
+        std::cout << "Error: " << ex.what() << std::endl;
+        failures++;
+      }
+    }
+  }
+
+  // the entry table is sorted by name for the binary search
+  std::sort(entries.begin(), entries.end(),
+    [](const EntryRecord & a, const EntryRecord & b) { return a.name < b.name; });
+
+  // write the tables
+  uint64_t base_table_offset = offset;
+  for (const BaseRecord & base_record : bases) {
+    InsertInt64L(out, base_record.offset);
+    InsertInt64L(out, base_record.size);
+  }
+  offset += bases.size() * kRomPackBaseRecordSize;
+
+  uint64_t entry_table_offset = offset;
+  uint64_t name_offset = entry_table_offset + entries.size() * kRomPackEntryRecordSize + patches.size() * kRomPackPatchRecordSize;
+  for (const EntryRecord & entry_record : entries) {
+    InsertInt64L(out, name_offset);
+    InsertInt32L(out, static_cast<uint32_t>(entry_record.name.size()));
+    InsertInt32L(out, entry_record.base_index);
+    InsertInt32L(out, entry_record.first_patch);
+    InsertInt32L(out, entry_record.patch_count);
+    InsertInt64L(out, entry_record.rom_size);
+    name_offset += entry_record.name.size();
+  }
+  offset += entries.size() * kRomPackEntryRecordSize;
+
+  uint64_t patch_table_offset = offset;
+  for (const PatchRecord & patch_record : patches) {
+    InsertInt64L(out, patch_record.offset);
+    InsertInt32L(out, patch_record.rom_offset);
+    InsertInt32L(out, patch_record.size);
+  }
+
+  for (const EntryRecord & entry_record : entries) {
+    out.write(entry_record.name.data(), entry_record.name.size());
+  }
+
+  // write the header
+  out.seekp(0);
+  out.write(kRomPackSignature, kRomPackSignatureSize);
+  InsertInt32L(out, kRomPackVersion);
+  InsertInt32L(out, static_cast<uint32_t>(bases.size()));
+  InsertInt32L(out, static_cast<uint32_t>(entries.size()));
+  InsertInt32L(out, static_cast<uint32_t>(patches.size()));
+  InsertInt64L(out, base_table_offset);
+  InsertInt64L(out, entry_table_offset);
+  InsertInt64L(out, patch_table_offset);
+
+  return failures;
+}
+
+constexpr size_t RomPackReader::npos;
+
+/// Opens a ROM pack.
+RomPackReader::RomPackReader(const std::string & filename) :
+    filename_(filename),
+    file_(filename) {
+  if (file_.size() < kRomPackHeaderSize || memcmp(file_.data(), kRomPackSignature, kRomPackSignatureSize) != 0) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Invalid ROM pack signature.";
+    throw std::runtime_error(message_buffer.str());
+  }
+
+  uint32_t version;
+  const char * header = file_.data() + kRomPackSignatureSize;
+  header = ReadInt32L(header, version);
+  if (version != kRomPackVersion) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Unsupported ROM pack version " << version << ".";
+    throw std::runtime_error(message_buffer.str());
+  }
+  header = ReadInt32L(header, base_count_);
+  header = ReadInt32L(header, entry_count_);
+  header = ReadInt32L(header, patch_count_);
+  header = ReadInt64L(header, base_table_offset_);
+  header = ReadInt64L(header, entry_table_offset_);
+  header = ReadInt64L(header, patch_table_offset_);
+
+  // check the table ranges
+  if (!is_range_in_file(base_table_offset_, static_cast<uint64_t>(base_count_) * kRomPackBaseRecordSize,
+        file_.size()) ||
+      !is_range_in_file(entry_table_offset_, static_cast<uint64_t>(entry_count_) * kRomPackEntryRecordSize,
+        file_.size()) ||
+      !is_range_in_file(patch_table_offset_, static_cast<uint64_t>(patch_count_) * kRomPackPatchRecordSize,
+        file_.size())) {
+    throw_corrupted();
+  }
+}
+
+/// Returns the number of ROMs.
+size_t RomPackReader::size() const {
+  return entry_count_;
+}
+
+/// Returns the name of a ROM.
+std::string RomPackReader::name(size_t index) const {
+  uint64_t name_offset;
+  uint32_t name_size;
+  const char * record = entry_record(index);
+  record = ReadInt64L(record, name_offset);
+  record = ReadInt32L(record, name_size);
+  if (!is_range_in_file(name_offset, name_size, file_.size())) {
+    throw_corrupted();
+  }
+  return std::string(file_.data() + name_offset, name_size);
+}
+
+/// Finds a ROM by name.
+size_t RomPackReader::find(const std::string & name) const {
+  size_t first = 0;
+  size_t last = size();
+  while (first < last) {
+    size_t middle = first + (last - first) / 2;
+    int result = this->name(middle).compare(name);
+    if (result == 0) {
+      return middle;
+    }
+    else if (result < 0) {
+      first = middle + 1;
+    }
+    else {
+      last = middle;
+    }
+  }
+  return npos;
+}
+
+/// Returns the size of a ROM.
+size_t RomPackReader::rom_size(size_t index) const {
+  uint64_t rom_size;
+  ReadInt64L(entry_record(index) + 24, rom_size);
+  if (rom_size > kNDSRomMaxSize) {
+    throw_corrupted();
+  }
+  return static_cast<size_t>(rom_size);
+}
+
+/// Reconstructs a ROM.
+void RomPackReader::extract(size_t index, char * rom) const {
+  uint32_t base_index;
+  uint32_t first_patch;
+  uint32_t patch_count;
+  const char * record = entry_record(index) + 12;
+  record = ReadInt32L(record, base_index);
+  record = ReadInt32L(record, first_patch);
+  record = ReadInt32L(record, patch_count);
+  size_t size = rom_size(index);
+
+  // copy the base image
+  if (base_index != kRomPackNoBase) {
+    if (base_index >= base_count_) {
+      throw_corrupted();
+    }
+
+    uint64_t base_offset;
+    uint64_t base_size;
+    const char * base_record = file_.data() + base_table_offset_ + base_index * kRomPackBaseRecordSize;
+    base_record = ReadInt64L(base_record, base_offset);
+    base_record = ReadInt64L(base_record, base_size);
+    if (base_size != size || !is_range_in_file(base_offset, base_size, file_.size())) {
+      throw_corrupted();
+    }
+    memcpy(rom, file_.data() + base_offset, size);
+  }
+  else {
+    memset(rom, 0, size);
+  }
+
+  // apply the patches
+  if (static_cast<uint64_t>(first_patch) + patch_count > patch_count_) {
+    throw_corrupted();
+  }
+  for (uint32_t patch_index = first_patch; patch_index < first_patch + patch_count; patch_index++) {
+    uint64_t patch_offset;
+    uint32_t patch_rom_offset;
+    uint32_t patch_size;
+    const char * patch_record = file_.data() + patch_table_offset_ + patch_index * kRomPackPatchRecordSize;
+    patch_record = ReadInt64L(patch_record, patch_offset);
+    patch_record = ReadInt32L(patch_record, patch_rom_offset);
+    patch_record = ReadInt32L(patch_record, patch_size);
+    if (static_cast<uint64_t>(patch_rom_offset) + patch_size > size ||
+        !is_range_in_file(patch_offset, patch_size, file_.size())) {
+      throw_corrupted();
+    }
+    memcpy(rom + patch_rom_offset, file_.data() + patch_offset, patch_size);
+  }
+}
+
+/// Returns the entry record of a ROM.
+const char * RomPackReader::entry_record(size_t index) const {
+  if (index >= entry_count_) {
+    std::ostringstream message_buffer;
+    message_buffer << filename_ << ": " << "ROM index " << index << " is out of range.";
+    throw std::out_of_range(message_buffer.str());
+  }
+  return file_.data() + entry_table_offset_ + index * kRomPackEntryRecordSize;
+}
+
+/// Throws an error for the corrupted pack.
+void RomPackReader::throw_corrupted() const {
+  std::ostringstream message_buffer;
+  message_buffer << filename_ << ": " << "ROM pack is corrupted.";
+  throw std::runtime_error(message_buffer.str());
+}
@@ -0,0 +1,151 @@
+/// @file
+/// ROM pack file classes header.
+///
+/// A ROM pack stores a collection of NDS ROM images converted from 2SF files.
+/// Each set of psflibs is stored once as a base image, and each ROM is stored
+/// as the ranges which differ from its base image. All integers are
+/// little-endian.
+///
+/// - Header (48 bytes)
+///   - 8 bytes signature "2SFPACK\x1a"
+///   - 4 bytes version
+///   - 4 bytes number of base images
+///   - 4 bytes number of entries
+///   - 4 bytes number of patches
+///   - 8 bytes offset of the base table
+///   - 8 bytes offset of the entry table
+///   - 8 bytes offset of the patch table
+/// - Base images and patch data, base images are aligned to kRomPackAlignment
+/// - Base table (16 bytes for each)
+///   - 8 bytes offset of the image
+///   - 8 bytes size of the image
+/// - Entry table, sorted by name (32 bytes for each)
+///   - 8 bytes offset of the name
+///   - 4 bytes size of the name
+///   - 4 bytes index of the base image, kRomPackNoBase for none
+///   - 4 bytes index of the first patch
+///   - 4 bytes number of patches
+///   - 8 bytes size of the ROM
+/// - Patch table (16 bytes for each)
+///   - 8 bytes offset of the data
+///   - 4 bytes offset in the ROM
+///   - 4 bytes size of the data
+/// - Names
+
+#ifndef ROM_PACK_HPP_
+#define ROM_PACK_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "mapped_file.hpp"
+
+/// The alignment of base images in a ROM pack.
+constexpr size_t kRomPackAlignment = 4096;
+
+/// The base index of an entry without base image.
+constexpr uint32_t kRomPackNoBase = 0xffffffff;
+
+/// The RomPackWriter class writes NDS ROM images of 2SF files to a ROM pack.
+class RomPackWriter {
+public:
+  /// Constructs a new RomPackWriter.
+  RomPackWriter() = default;
+
+  /// Adds a file to be packed.
+  /// @param filename the path to 2sf file.
+  /// @param name the name of the ROM in the pack.
+  void add(const std::string & filename, const std::string & name);
+
+  /// Writes all added files to a ROM pack.
+  /// @param filename the path to the ROM pack.
+  /// @return the number of files which failed to be packed.
+  ///
+  /// @remarks Errors are reported to the standard output for each file.
+  int write(const std::string & filename);
+
+private:
+  /// The Entry struct represents a file to be packed.
+  struct Entry {
+    /// The path to 2sf file.
+    std::string filename;
+
+    /// The name of the ROM in the pack.
+    std::string name;
+  };
+
+  /// Files to be packed.
+  std::vector<Entry> entries_;
+};
+
+/// The RomPackReader class reconstructs NDS ROM images from a ROM pack.
+class RomPackReader {
+public:
+  /// The index returned when no entry is found.
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  /// Opens a ROM pack.
+  /// @param filename the path to the ROM pack.
+  explicit RomPackReader(const std::string & filename);
+
+  /// Returns the number of ROMs.
+  /// @return the number of ROMs.
+  size_t size() const;
+
+  /// Returns the name of a ROM.
+  /// @param index the index of the ROM.
+  /// @return the name of the ROM.
+  std::string name(size_t index) const;
+
+  /// Finds a ROM by name.
+  /// @param name the name of the ROM.
+  /// @return the index of the ROM, or npos if not found.
+  size_t find(const std::string & name) const;
+
+  /// Returns the size of a ROM.
+  /// @param index the index of the ROM.
+  /// @return the size of the ROM.
+  size_t rom_size(size_t index) const;
+
+  /// Reconstructs a ROM.
+  /// @param index the index of the ROM.
+  /// @param rom the buffer of rom_size bytes.
+  void extract(size_t index, char * rom) const;
+
+private:
+  /// Returns the entry record of a ROM.
+  /// @param index the index of the ROM.
+  /// @return the pointer to the entry record.
+  const char * entry_record(size_t index) const;
+
+  /// Throws an error for the corrupted pack.
+  [[noreturn]] void throw_corrupted() const;
+
+  /// The path to the ROM pack.
+  std::string filename_;
+
+  /// The mapped ROM pack.
+  MappedFile file_;
+
+  /// The number of base images.
+  uint32_t base_count_;
+
+  /// The number of entries.
+  uint32_t entry_count_;
+
+  /// The number of patches.
+  uint32_t patch_count_;
+
+  /// Offset of the base table.
+  uint64_t base_table_offset_;
+
+  /// Offset of the entry table.
+  uint64_t entry_table_offset_;
+
+  /// Offset of the patch table.
+  uint64_t patch_table_offset_;
+};
+
+#endif // !ROM_PACK_HPP_
@@ -0,0 +1,428 @@
+/// @file
+/// RomServer class implementation.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+#include "rom_loader.hpp"
+#include "rom_server.hpp"
+
+namespace {
+
+/// The maximum length of a request line.
+constexpr size_t kRomServerMaxRequestSize = 4096;
+
+/// Throws an error of a system call.
+/// @param name the name of the object of the call.
+/// @param message the description of the failure.
+[[noreturn]] void throw_system_error(const std::string & name, const char * message) {
+  std::ostringstream message_buffer;
+  message_buffer << name << ": " << message << " (" << strerror(errno) << ")";
+  throw std::runtime_error(message_buffer.str());
+}
+
+#ifndef __linux__
+/// Throws an error for the platforms without memfd and fd passing.
+[[noreturn]] void throw_not_supported() {
+  throw std::runtime_error("The ROM server is not supported on this platform.");
+}
+#endif
+
+#ifdef __linux__
+/// Fills a UNIX socket address.
+/// @param socket_path the path to the UNIX socket.
+/// @param address the address to be filled.
+void make_socket_address(const std::string & socket_path, struct sockaddr_un & address) {
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    std::ostringstream message_buffer;
+    message_buffer << socket_path << ": " << "Socket path too long.";
+    throw std::invalid_argument(message_buffer.str());
+  }
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+}
+
+/// Reads a line from a socket.
+/// @param fd the descriptor of the socket.
+/// @param buffer the bytes received after the previous line.
+/// @param line the line without the newline.
+/// @return false if the peer has closed the connection.
+bool read_line(int fd, std::string & buffer, std::string & line) {
+  size_t newline;
+  while ((newline = buffer.find('\n')) == std::string::npos) {
+    if (buffer.size() > kRomServerMaxRequestSize) {
+      throw std::runtime_error("Request too long.");
+    }
+
+    char chunk[512];
+    ssize_t length = recv(fd, chunk, sizeof(chunk), 0);
+    if (length < 0 && errno == EINTR) {
+      continue;
+    }
+    if (length <= 0) {
+      return false;
+    }
+    buffer.append(chunk, static_cast<size_t>(length));
+  }
+
+  line = buffer.substr(0, newline);
+  buffer.erase(0, newline + 1);
+  return true;
+}
+
+/// Sends a message with an optional descriptor.
+/// @param connection the descriptor of the connection.
+/// @param response the message line.
+/// @param fd the descriptor to be passed, -1 for none.
+/// @return false if the message could not be sent.
+bool send_message(int connection, const std::string & response, int fd) {
+  struct iovec iov;
+  iov.iov_base = const_cast<char *>(response.data());
+  iov.iov_len = response.size();
+
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  if (fd != -1) {
+    memset(&control, 0, sizeof(control));
+    message.msg_control = control.buf;
+    message.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  // the descriptor goes with the first byte, the rest is plain data
+  ssize_t length;
+  do {
+    length = sendmsg(connection, &message, MSG_NOSIGNAL);
+  } while (length < 0 && errno == EINTR);
+  if (length < 0) {
+    return false;
+  }
+
+  size_t sent = static_cast<size_t>(length);
+  while (sent < response.size()) {
+    length = send(connection, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+    if (length < 0 && errno == EINTR) {
+      continue;
+    }
+    if (length <= 0) {
+      return false;
+    }
+    sent += static_cast<size_t>(length);
+  }
+  return true;
+}
+#endif
+
+} // namespace
+
+/// Compose the ROM image of a 2SF file into a sealed memory file.
+int compose_rom_memfd(const std::string & filename, size_t & size) {
+#ifdef __linux__
+  std::vector<PSFProgram> programs = resolve_2sf(filename);
+  size = get_rom_size(programs);
+
+  int fd = memfd_create("2sf2rom", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd == -1) {
+    throw_system_error(filename, "Unable to create a memory file.");
+  }
+
+  try {
+    // a new memory file reads as zeros, so the gaps are never touched
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      throw_system_error(filename, "Unable to resize the memory file.");
+    }
+
+    if (size != 0) {
+      void * map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (map == MAP_FAILED) {
+        throw_system_error(filename, "Unable to map the memory file.");
+      }
+
+      try {
+        for (const PSFProgram & program : programs) {
+          inflate_program(program, static_cast<char *>(map) + program.load_offset);
+        }
+      }
+      catch (...) {
+        munmap(map, size);
+        throw;
+      }
+
+      // the write seal requires no writable mappings
+      munmap(map, size);
+    }
+
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+      throw_system_error(filename, "Unable to seal the memory file.");
+    }
+  }
+  catch (...) {
+    close(fd);
+    throw;
+  }
+  return fd;
+#else
+  (void)filename;
+  (void)size;
+  throw_not_supported();
+#endif
+}
+
+/// Request the ROM image of a 2SF file from a RomServer.
+int request_rom(const std::string & socket_path, const std::string & filename, size_t & size) {
+#ifdef __linux__
+  if (filename.find('\n') != std::string::npos) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Invalid filename.";
+    throw std::invalid_argument(message_buffer.str());
+  }
+
+  struct sockaddr_un address;
+  make_socket_address(socket_path, address);
+
+  int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (connection == -1) {
+    throw_system_error(socket_path, "Unable to create a socket.");
+  }
+
+  int fd = -1;
+  try {
+    if (connect(connection, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0) {
+      throw_system_error(socket_path, "Unable to connect to the server.");
+    }
+
+    if (!send_message(connection, filename + "\n", -1)) {
+      throw_system_error(socket_path, "Unable to send the request.");
+    }
+
+    // the descriptor arrives with the first byte of the response
+    std::string response;
+    while (response.empty() || response.back() != '\n') {
+      char chunk[512];
+      struct iovec iov;
+      iov.iov_base = chunk;
+      iov.iov_len = sizeof(chunk);
+
+      union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+      } control;
+      struct msghdr message;
+      memset(&message, 0, sizeof(message));
+      message.msg_iov = &iov;
+      message.msg_iovlen = 1;
+      message.msg_control = control.buf;
+      message.msg_controllen = sizeof(control.buf);
+
+      ssize_t length = recvmsg(connection, &message, MSG_CMSG_CLOEXEC);
+      if (length < 0 && errno == EINTR) {
+        continue;
+      }
+      if (length < 0) {
+        throw_system_error(socket_path, "Unable to receive the response.");
+      }
+      if (length == 0) {
+        std::ostringstream message_buffer;
+        message_buffer << socket_path << ": " << "Connection closed by the server.";
+        throw std::runtime_error(message_buffer.str());
+      }
+
+      for (struct cmsghdr * cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && fd == -1) {
+          memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+      }
+      response.append(chunk, static_cast<size_t>(length));
+    }
+    response.pop_back();
+
+    if (response.compare(0, 3, "OK ") != 0 || fd == -1) {
+      std::ostringstream message_buffer;
+      if (response.compare(0, 6, "ERROR ") == 0) {
+        message_buffer << response.substr(6);
+      }
+      else {
+        message_buffer << socket_path << ": " << "Invalid response.";
+      }
+      throw std::runtime_error(message_buffer.str());
+    }
+    size = static_cast<size_t>(std::stoull(response.substr(3)));
+  }
+  catch (...) {
+    if (fd != -1) {
+      close(fd);
+    }
+    close(connection);
+    throw;
+  }
+
+  close(connection);
+  return fd;
+#else
+  (void)socket_path;
+  (void)filename;
+  (void)size;
+  throw_not_supported();
+#endif
+}
+
+/// Constructs a new RomServer.
+RomServer::RomServer(const std::string & socket_path, unsigned int socket_mode, size_t max_connections) :
+    socket_path_(socket_path),
+    socket_(-1),
+    max_connections_(max_connections != 0 ? max_connections : 1),
+    connections_(std::make_shared<ConnectionCount>()) {
+#ifdef __linux__
+  struct sockaddr_un address;
+  make_socket_address(socket_path_, address);
+
+  socket_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (socket_ == -1) {
+    throw_system_error(socket_path_, "Unable to create a socket.");
+  }
+
+  // replace the socket left by a previous server, and restrict it before
+  // listening, since any user who can connect can have the files read
+  struct stat st;
+  if (lstat(socket_path_.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      close(socket_);
+      std::ostringstream message_buffer;
+      message_buffer << socket_path_ << ": " << "File exists and is not a socket.";
+      throw std::runtime_error(message_buffer.str());
+    }
+    unlink(socket_path_.c_str());
+  }
+  if (bind(socket_, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0 ||
+      chmod(socket_path_.c_str(), static_cast<mode_t>(socket_mode)) != 0 ||
+      listen(socket_, SOMAXCONN) != 0) {
+    int error = errno;
+    close(socket_);
+    errno = error;
+    throw_system_error(socket_path_, "Unable to listen on the socket.");
+  }
+#else
+  (void)socket_mode;
+  throw_not_supported();
+#endif
+}
+
+/// Closes the socket and removes its path.
+RomServer::~RomServer() {
+#ifdef __linux__
+  if (socket_ != -1) {
+    close(socket_);
+    unlink(socket_path_.c_str());
+  }
+#endif
+}
+
+/// Serves connections until an error occurs.
+void RomServer::run() {
+#ifdef __linux__
+  while (true) {
+    // wait for a thread to finish, leaving new connections in the backlog
+    {
+      std::unique_lock<std::mutex> lock(connections_->mutex);
+      connections_->finished.wait(lock, [this] { return connections_->active < max_connections_; });
+    }
+
+    int connection = accept4(socket_, NULL, NULL, SOCK_CLOEXEC);
+    if (connection == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      throw_system_error(socket_path_, "Unable to accept a connection.");
+    }
+
+    // the count is shared with the threads, which may outlive the server
+    std::shared_ptr<ConnectionCount> connections = connections_;
+    {
+      std::lock_guard<std::mutex> lock(connections->mutex);
+      connections->active++;
+    }
+    std::thread([connections, connection] {
+      serve(connection);
+      std::lock_guard<std::mutex> lock(connections->mutex);
+      connections->active--;
+      connections->finished.notify_one();
+    }).detach();
+  }
+#endif
+}
+
+/// Serves the requests of a connection.
+void RomServer::serve(int connection) {
+#ifdef __linux__
+  std::string buffer;
+  std::string filename;
+  try {
+    while (read_line(connection, buffer, filename)) {
+      size_t size = 0;
+      int fd = -1;
+      std::string response;
+      try {
+        fd = compose_rom_memfd(filename, size);
+        response = "OK " + std::to_string(size) + "\n";
+      }
+      catch (const std::exception & ex) {
+        std::string message(ex.what());
+        for (char & c : message) {
+          if (c == '\n') {
+            c = ' ';
+          }
+        }
+        response = "ERROR " + message + "\n";
+      }
+
+      bool sent = send_message(connection, response, fd);
+      if (fd != -1) {
+        close(fd);
+      }
+      if (!sent) {
+        break;
+      }
+    }
+  }
+  catch (const std::exception &) {
+    // drop the connection on a malformed request
+  }
+  close(connection);
+#else
+  (void)connection;
+#endif
+}
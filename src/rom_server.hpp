@@ -0,0 +1,103 @@
+/// @file
+/// RomServer class header.
+
+#ifndef ROM_SERVER_HPP_
+#define ROM_SERVER_HPP_
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/// The default permissions of the socket of RomServer (owner only).
+constexpr unsigned int kRomServerDefaultSocketMode = 0600;
+
+/// The default maximum number of connections served at once by RomServer.
+constexpr size_t kRomServerDefaultMaxConnections = 64;
+
+/// Compose the ROM image of a 2SF file into a sealed memory file.
+/// @param filename the path to 2sf file.
+/// @param size the size of the ROM image.
+/// @return the file descriptor of the memory file, which the caller owns.
+///
+/// @remarks The programs are decompressed directly into a shared mapping of
+/// the memory file, which is then sealed against writing and resizing.
+/// Only supported on Linux.
+int compose_rom_memfd(const std::string & filename, size_t & size);
+
+/// Request the ROM image of a 2SF file from a RomServer.
+/// @param socket_path the path to the UNIX socket of the server.
+/// @param filename the path to 2sf file, as seen by the server.
+/// @param size the size of the ROM image.
+/// @return the file descriptor of the sealed memory file, which the caller
+/// owns and can map read-only.
+int request_rom(const std::string & socket_path, const std::string & filename, size_t & size);
+
+/// The RomServer class serves composed ROM images over a UNIX socket.
+///
+/// A client sends the path to a 2SF file terminated by a newline, and
+/// receives "OK <size>\n" with the descriptor of a sealed memory file holding
+/// the ROM image (SCM_RIGHTS), or "ERROR <message>\n" without descriptors.
+/// Multiple requests can be sent over a connection. The ROM never touches
+/// the disk, and the client maps the same pages the server has written.
+///
+/// The server reads any file it can read on behalf of its clients, so the
+/// socket is only accessible by the owner by default.
+class RomServer {
+public:
+  /// Constructs a new RomServer.
+  /// @param socket_path the path to the UNIX socket. A socket left at the
+  /// path is replaced, but any other file is kept and fails the construction.
+  /// @param socket_mode the permissions of the socket.
+  /// @param max_connections the maximum number of connections served at
+  /// once, each on its own thread.
+  explicit RomServer(const std::string & socket_path, unsigned int socket_mode = kRomServerDefaultSocketMode,
+    size_t max_connections = kRomServerDefaultMaxConnections);
+
+  RomServer(const RomServer &) = delete;
+  RomServer & operator=(const RomServer &) = delete;
+
+  /// Closes the socket and removes its path.
+  ~RomServer();
+
+  /// Serves connections until an error occurs.
+  ///
+  /// @remarks Each connection is served on its own thread. When the
+  /// maximum number of connections are served, new connections wait in the
+  /// backlog of the socket.
+  void run();
+
+private:
+  /// The ConnectionCount struct represents the number of connections being
+  /// served.
+  struct ConnectionCount {
+    /// The mutex guarding the count.
+    std::mutex mutex;
+
+    /// Notified when a connection is closed.
+    std::condition_variable finished;
+
+    /// The number of connections being served.
+    size_t active = 0;
+  };
+
+  /// Serves the requests of a connection.
+  /// @param connection the descriptor of the connection, closed on return.
+  static void serve(int connection);
+
+  /// The path to the UNIX socket.
+  std::string socket_path_;
+
+  /// The descriptor of the listening socket.
+  int socket_;
+
+  /// The maximum number of connections served at once.
+  size_t max_connections_;
+
+  /// The number of connections being served, shared with their threads.
+  std::shared_ptr<ConnectionCount> connections_;
+};
+
+#endif // !ROM_SERVER_HPP_
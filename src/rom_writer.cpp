@@ -0,0 +1,269 @@
+/// @file
+/// NDS ROM writer implementation.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "byteio.hpp"
+#include "parallel.hpp"
+#include "probes.h"
+#include "rom_writer.hpp"
+
+namespace {
+
+/// Write uncompressed ROM image to file.
+/// @param filename the path to the output ROM file.
+/// @param rom the ROM image.
+/// @param size the size of the ROM image.
+void write_rom_raw(const std::string & filename, const char * rom, size_t size) {
+  std::ofstream out;
+  out.exceptions(std::ios::badbit | std::ios::failbit);
+  out.open(filename, std::ios::binary);
+  out.write(rom, size);
+}
+
+/// Returns true if the data is filled with zero.
+/// @param data the data.
+/// @param size the size of the data.
+/// @return true if all bytes are zero.
+bool is_zero_filled(const char * data, size_t size) {
+  // every byte equals the next one, and the first one is zero
+  return size == 0 || (data[0] == 0 && memcmp(data, data + 1, size - 1) == 0);
+}
+
+/// Write uncompressed ROM image to file in segments on multiple threads.
+/// @param filename the path to the output ROM file.
+/// @param rom the ROM image.
+/// @param size the size of the ROM image.
+/// @param thread_count the maximum number of threads, 0 for the default.
+void write_rom_parallel_raw(const std::string & filename, const char * rom, size_t size, unsigned int thread_count) {
+#ifdef _WIN32
+  (void)thread_count;
+  write_rom_raw(filename, rom, size);
+#else
+  int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd == -1) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Unable to open the output file.";
+    throw std::runtime_error(message_buffer.str());
+  }
+
+  try {
+    // the file reads as zero where no segment is written
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      std::ostringstream message_buffer;
+      message_buffer << filename << ": " << "Unable to resize the output file.";
+      throw std::runtime_error(message_buffer.str());
+    }
+#ifdef __linux__
+    // allocate the blocks at once, if the file system supports it
+    if (size != 0) {
+      fallocate(fd, 0, 0, static_cast<off_t>(size));
+    }
+#endif
+
+    size_t segment_count = (size + kParallelWriteSegmentSize - 1) / kParallelWriteSegmentSize;
+    parallel_for(segment_count, thread_count, [&](size_t segment_index) {
+      size_t offset = segment_index * kParallelWriteSegmentSize;
+      size_t remaining = std::min(kParallelWriteSegmentSize, size - offset);
+      if (is_zero_filled(rom + offset, remaining)) {
+        return;
+      }
+
+      while (remaining != 0) {
+        ssize_t written = pwrite(fd, rom + offset, remaining, static_cast<off_t>(offset));
+        if (written < 0 && errno == EINTR) {
+          continue;
+        }
+        if (written <= 0) {
+          std::ostringstream message_buffer;
+          message_buffer << filename << ": " << "Unable to write the output file.";
+          throw std::runtime_error(message_buffer.str());
+        }
+        offset += static_cast<size_t>(written);
+        remaining -= static_cast<size_t>(written);
+      }
+    });
+  }
+  catch (...) {
+    close(fd);
+    throw;
+  }
+
+  if (close(fd) != 0) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Unable to write the output file.";
+    throw std::runtime_error(message_buffer.str());
+  }
+#endif
+}
+
+/// Write uncompressed ROM image to file with O_DIRECT.
+/// @param filename the path to the output ROM file.
+/// @param rom the ROM image.
+/// @param size the size of the ROM image.
+void write_rom_direct_raw(const std::string & filename, const char * rom, size_t size) {
+#ifdef __linux__
+  int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0666);
+  void * buffer_memory = nullptr;
+  if (fd == -1 || posix_memalign(&buffer_memory, kDirectWriteAlignment, kDirectWriteBufferSize) != 0) {
+    // the file system may not support O_DIRECT (EINVAL)
+    if (fd != -1) {
+      close(fd);
+    }
+    write_rom_raw(filename, rom, size);
+    return;
+  }
+  std::unique_ptr<char, decltype(&free)> buffer(static_cast<char *>(buffer_memory), &free);
+
+  // the last block is padded with zero, and cut off by ftruncate
+  size_t offset = 0;
+  bool success = true;
+  while (offset < size && success) {
+    size_t length = std::min(kDirectWriteBufferSize, size - offset);
+    size_t padded_length = (length + kDirectWriteAlignment - 1) / kDirectWriteAlignment * kDirectWriteAlignment;
+    memcpy(buffer.get(), rom + offset, length);
+    memset(buffer.get() + length, 0, padded_length - length);
+
+    size_t written_length = 0;
+    while (written_length < padded_length) {
+      ssize_t written = write(fd, buffer.get() + written_length, padded_length - written_length);
+      if (written < 0 && errno == EINTR) {
+        continue;
+      }
+      if (written <= 0) {
+        success = false;
+        break;
+      }
+      written_length += static_cast<size_t>(written);
+    }
+    offset += length;
+  }
+
+  if (success && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    success = false;
+  }
+  if (close(fd) != 0) {
+    success = false;
+  }
+
+  // the alignment may be larger than assumed (EINVAL), write it again
+  if (!success) {
+    write_rom_raw(filename, rom, size);
+  }
+#else
+  write_rom_raw(filename, rom, size);
+#endif
+}
+
+/// Compress data into a gzip member.
+/// @param filename the path to the output ROM file, for error messages.
+/// @param data the data to be compressed.
+/// @param size the size of the data.
+/// @param member the buffer to receive the gzip member.
+void deflate_gzip_member(const std::string & filename, const char * data, size_t size, std::vector<char> & member) {
+  z_stream z = {};
+  if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Unable to initialize zlib.";
+    throw std::runtime_error(message_buffer.str());
+  }
+
+  member.resize(deflateBound(&z, static_cast<uLong>(size)));
+  z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+  z.avail_in = static_cast<uInt>(size);
+  z.next_out = reinterpret_cast<Bytef *>(member.data());
+  z.avail_out = static_cast<uInt>(member.size());
+  int zresult = deflate(&z, Z_FINISH);
+  member.resize(member.size() - z.avail_out);
+  deflateEnd(&z);
+
+  if (zresult != Z_STREAM_END) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Failed to compress data.";
+    throw std::runtime_error(message_buffer.str());
+  }
+}
+
+/// Write ROM image to file as chunked gzip, with the index file.
+/// @param filename the path to the output ROM file.
+/// @param rom the ROM image.
+/// @param size the size of the ROM image.
+/// @param thread_count the maximum number of threads, 0 for the default.
+void write_rom_chunked_gzip(const std::string & filename, const char * rom, size_t size, unsigned int thread_count) {
+  // compress all chunks in parallel
+  // (an empty ROM is written as an empty gzip member)
+  size_t chunk_count = std::max<size_t>((size + kGzipChunkSize - 1) / kGzipChunkSize, 1);
+  std::vector<std::vector<char>> members(chunk_count);
+  parallel_for(chunk_count, thread_count, [&](size_t chunk_index) {
+    size_t chunk_offset = chunk_index * kGzipChunkSize;
+    size_t chunk_size = std::min(kGzipChunkSize, size - chunk_offset);
+    deflate_gzip_member(filename, rom + chunk_offset, chunk_size, members[chunk_index]);
+  });
+
+  std::ofstream out;
+  out.exceptions(std::ios::badbit | std::ios::failbit);
+  out.open(filename, std::ios::binary);
+
+  std::ofstream index_out;
+  index_out.exceptions(std::ios::badbit | std::ios::failbit);
+  index_out.open(filename + ".gzi", std::ios::binary);
+  InsertInt64L(index_out, chunk_count - 1);
+
+  uint64_t compressed_offset = 0;
+  for (size_t chunk_index = 0; chunk_index < chunk_count; chunk_index++) {
+    if (chunk_index != 0) {
+      InsertInt64L(index_out, compressed_offset);
+      InsertInt64L(index_out, static_cast<uint64_t>(chunk_index) * kGzipChunkSize);
+    }
+
+    out.write(members[chunk_index].data(), members[chunk_index].size());
+    compressed_offset += members[chunk_index].size();
+  }
+}
+
+} // namespace
+
+/// Write ROM image to file.
+void write_rom(const std::string & filename, const char * rom, size_t size, RomOutputMode mode,
+    unsigned int thread_count) {
+  PROBE_DECLARE_TIMESTAMP(write_start);
+  switch (mode) {
+  case RomOutputMode::kChunkedGzip:
+    write_rom_chunked_gzip(filename, rom, size, thread_count);
+    break;
+
+  case RomOutputMode::kNull:
+    break;
+
+  case RomOutputMode::kParallelRaw:
+    write_rom_parallel_raw(filename, rom, size, thread_count);
+    break;
+
+  case RomOutputMode::kDirectRaw:
+    write_rom_direct_raw(filename, rom, size);
+    break;
+
+  default:
+    write_rom_raw(filename, rom, size);
+    break;
+  }
+  PROBE_ROM_WRITE(filename.c_str(), size, probe_timestamp() - write_start);
+}
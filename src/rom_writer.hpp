@@ -0,0 +1,63 @@
+/// @file
+/// NDS ROM writer header.
+
+#ifndef ROM_WRITER_HPP_
+#define ROM_WRITER_HPP_
+
+#include <string>
+
+/// The size of each gzip member of the chunked gzip output.
+constexpr size_t kGzipChunkSize = 1024 * 1024;
+
+/// The size of each segment of the parallel raw output.
+constexpr size_t kParallelWriteSegmentSize = 4 * 1024 * 1024;
+
+/// The size of the buffer of the direct raw output.
+constexpr size_t kDirectWriteBufferSize = 1024 * 1024;
+
+/// The alignment of the buffer, offsets and sizes of the direct raw output.
+constexpr size_t kDirectWriteAlignment = 4096;
+
+/// The RomOutputMode enum represents the format of the output ROM file.
+enum class RomOutputMode {
+  /// Uncompressed ROM image.
+  kRaw,
+
+  /// Sequence of independent gzip members of kGzipChunkSize bytes each,
+  /// with an index file (filename + ".gzi").
+  ///
+  /// The index is laid out as the one of bgzip: the number of entries
+  /// followed by pairs of compressed and uncompressed offsets of each member
+  /// except the first one, as 64-bit little-endian integers. The members
+  /// are plain gzip members, not BGZF blocks (64 KiB at most, with the BC
+  /// extra field), so the file itself is not readable by bgzip as BGZF.
+  kChunkedGzip,
+
+  /// Nothing is written, for measuring the conversion alone.
+  kNull,
+
+  /// Uncompressed ROM image, preallocated and written in segments of
+  /// kParallelWriteSegmentSize bytes by multiple threads. Segments filled
+  /// with zero are not written.
+  kParallelRaw,
+
+  /// Uncompressed ROM image written with O_DIRECT through aligned buffers of
+  /// kDirectWriteBufferSize bytes, bypassing the page cache. Falls back to
+  /// kRaw where O_DIRECT is not supported.
+  kDirectRaw,
+};
+
+/// Write ROM image to file.
+/// @param filename the path to the output ROM file.
+/// @param rom the ROM image.
+/// @param size the size of the ROM image.
+/// @param mode the format of the output ROM file.
+/// @param thread_count the maximum number of threads compressing the
+/// members of kChunkedGzip or writing the segments of kParallelRaw, 0 for
+/// the hardware threads. Callers running
+/// several conversions at once pass their share, so that the threads are
+/// not multiplied by the number of workers.
+void write_rom(const std::string & filename, const char * rom, size_t size,
+  RomOutputMode mode = RomOutputMode::kRaw, unsigned int thread_count = 0);
+
+#endif // !ROM_WRITER_HPP_
@@ -0,0 +1,447 @@
+/// @file
+/// TarConverter class implementation.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+#include "lib_cache.hpp"
+#include "psf_file.hpp"
+#include "rom_loader.hpp"
+#include "rom_writer.hpp"
+#include "tar_converter.hpp"
+#include "cpath.h"
+
+namespace {
+
+/// The offset of the name field of a tar header.
+constexpr size_t kTarNameOffset = 0;
+
+/// The size of the name field of a tar header.
+constexpr size_t kTarNameSize = 100;
+
+/// The offset of the size field of a tar header.
+constexpr size_t kTarSizeOffset = 124;
+
+/// The size of the size field of a tar header.
+constexpr size_t kTarSizeSize = 12;
+
+/// The offset of the checksum field of a tar header.
+constexpr size_t kTarChecksumOffset = 148;
+
+/// The size of the checksum field of a tar header.
+constexpr size_t kTarChecksumSize = 8;
+
+/// The offset of the type flag of a tar header.
+constexpr size_t kTarTypeOffset = 156;
+
+/// The offset of the magic field of a tar header.
+constexpr size_t kTarMagicOffset = 257;
+
+/// The offset of the prefix field of a ustar header.
+constexpr size_t kTarPrefixOffset = 345;
+
+/// The size of the prefix field of a ustar header.
+constexpr size_t kTarPrefixSize = 155;
+
+/// Returns a string field of a tar header.
+/// @param header the tar header.
+/// @param offset the offset of the field.
+/// @param size the size of the field.
+/// @return the string up to the first NUL.
+std::string get_tar_string(const char * header, size_t offset, size_t size) {
+  const char * field = header + offset;
+  return std::string(field, std::find(field, field + size, '\0'));
+}
+
+/// Returns a number field of a tar header.
+/// @param header the tar header.
+/// @param offset the offset of the field.
+/// @param size the size of the field.
+/// @return the value of the field, in octal or in base-256 (GNU).
+uint64_t get_tar_number(const char * header, size_t offset, size_t size) {
+  const unsigned char * field = reinterpret_cast<const unsigned char *>(header + offset);
+  uint64_t value = 0;
+  if ((field[0] & 0x80) != 0) {
+    value = field[0] & 0x7f;
+    for (size_t i = 1; i < size; i++) {
+      value = (value << 8) | field[i];
+    }
+    return value;
+  }
+
+  size_t i = 0;
+  while (i < size && field[i] == ' ') {
+    i++;
+  }
+  for (; i < size && field[i] >= '0' && field[i] <= '7'; i++) {
+    value = (value << 3) | (field[i] - '0');
+  }
+  return value;
+}
+
+/// Normalizes a path in an archive.
+/// @param path the path, separated by slashes or backslashes.
+/// @return the path without empty, "." and inner ".." components.
+std::string normalize_tar_path(const std::string & path) {
+  std::vector<std::string> components;
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find_first_of("/\\", start);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+
+    std::string component = path.substr(start, end - start);
+    if (component == "..") {
+      if (!components.empty() && components.back() != "..") {
+        components.pop_back();
+      }
+      else {
+        components.push_back(component);
+      }
+    }
+    else if (!component.empty() && component != ".") {
+      components.push_back(component);
+    }
+    start = end + 1;
+  }
+
+  std::string normalized_path;
+  for (const std::string & component : components) {
+    if (!normalized_path.empty()) {
+      normalized_path += '/';
+    }
+    normalized_path += component;
+  }
+  return normalized_path;
+}
+
+/// Returns the lowercase extension of a path.
+/// @param path the path.
+/// @return the extension including the dot, or an empty string.
+std::string get_extension(const std::string & path) {
+  size_t dot = path.find_last_of('.');
+  if (dot == std::string::npos || path.find('/', dot) != std::string::npos) {
+    return std::string();
+  }
+
+  std::string extension = path.substr(dot);
+  std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) {
+    return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  });
+  return extension;
+}
+
+/// Creates the parent directories of a file.
+/// @param filename the path to the file.
+void make_parent_directories(const std::string & filename) {
+  for (size_t separator = filename.find_first_of("/\\", 1); separator != std::string::npos;
+      separator = filename.find_first_of("/\\", separator + 1)) {
+    std::string directory = filename.substr(0, separator);
+#ifdef _WIN32
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0777);
+#endif
+  }
+}
+
+} // namespace
+
+/// Constructs a new TarConverter.
+TarConverter::TarConverter(const std::string & output_directory, RomOutputMode output_mode, size_t cache_capacity) :
+    output_directory_(output_directory),
+    output_mode_(output_mode),
+    cache_(cache_capacity) {
+}
+
+/// Converts the 2SF files in a tar stream.
+int TarConverter::run(std::istream & in, const std::string & name) {
+  int failures = 0;
+
+  // the overrides of the next member given by pax or GNU headers
+  std::string next_path;
+  bool next_size_given = false;
+  uint64_t next_size = 0;
+
+  char header[kTarBlockSize];
+  while (true) {
+    in.read(header, sizeof(header));
+    if (in.gcount() == 0) {
+      break;
+    }
+    if (in.gcount() != static_cast<std::streamsize>(sizeof(header))) {
+      std::ostringstream message_buffer;
+      message_buffer << name << ": " << "Unexpected end of the archive.";
+      throw std::runtime_error(message_buffer.str());
+    }
+
+    // a zero block marks the end of the archive
+    if (std::all_of(header, header + sizeof(header), [](char c) { return c == '\0'; })) {
+      break;
+    }
+
+    uint64_t checksum = 0;
+    for (size_t i = 0; i < sizeof(header); i++) {
+      bool in_checksum = i >= kTarChecksumOffset && i < kTarChecksumOffset + kTarChecksumSize;
+      checksum += in_checksum ? ' ' : static_cast<unsigned char>(header[i]);
+    }
+    if (checksum != get_tar_number(header, kTarChecksumOffset, kTarChecksumSize)) {
+      std::ostringstream message_buffer;
+      message_buffer << name << ": " << "Invalid tar header checksum.";
+      throw std::runtime_error(message_buffer.str());
+    }
+
+    // the headers of pax and GNU describe the next member
+    char type = header[kTarTypeOffset];
+    bool metadata = (type == 'x' || type == 'g' || type == 'L');
+    uint64_t size = get_tar_number(header, kTarSizeOffset, kTarSizeSize);
+    std::string path = get_tar_string(header, kTarNameOffset, kTarNameSize);
+    std::string prefix = get_tar_string(header, kTarPrefixOffset, kTarPrefixSize);
+    if (memcmp(header + kTarMagicOffset, "ustar", 5) == 0 && !prefix.empty()) {
+      path = prefix + "/" + path;
+    }
+    if (!metadata) {
+      if (next_size_given) {
+        size = next_size;
+      }
+      if (!next_path.empty()) {
+        path = next_path;
+      }
+      next_path.clear();
+      next_size_given = false;
+    }
+
+    // read the members of interest, skip the others
+    bool regular = (type == '0' || type == '\0' || type == '7');
+    std::string extension = get_extension(path);
+    bool wanted = (type == 'x' || type == 'L') ||
+      (regular && (extension == ".2sflib" || extension == ".2sf" || extension == ".mini2sf"));
+    uint64_t padded_size = (size + kTarBlockSize - 1) / kTarBlockSize * kTarBlockSize;
+    std::string data;
+    if (wanted) {
+      if (size > kNDSRomMaxSize * 2) {
+        std::ostringstream message_buffer;
+        message_buffer << name << ": " << path << ": " << "Member too large.";
+        throw std::runtime_error(message_buffer.str());
+      }
+      data.resize(static_cast<size_t>(size));
+      in.read(&data[0], static_cast<std::streamsize>(size));
+      in.ignore(static_cast<std::streamsize>(padded_size - size));
+    }
+    else {
+      in.ignore(static_cast<std::streamsize>(padded_size));
+    }
+    if (!in) {
+      std::ostringstream message_buffer;
+      message_buffer << name << ": " << "Unexpected end of the archive.";
+      throw std::runtime_error(message_buffer.str());
+    }
+
+    if (type == 'L') {
+      next_path = data.substr(0, data.find('\0'));
+    }
+    else if (type == 'x') {
+      // records of "length key=value\n"
+      size_t position = 0;
+      while (position < data.size()) {
+        size_t space = data.find(' ', position);
+        if (space == std::string::npos) {
+          break;
+        }
+        size_t length = static_cast<size_t>(strtoul(data.c_str() + position, NULL, 10));
+        if (length == 0 || position + length > data.size()) {
+          break;
+        }
+        std::string record = data.substr(space + 1, position + length - space - 2);
+        size_t equal = record.find('=');
+        if (equal != std::string::npos) {
+          std::string key = record.substr(0, equal);
+          if (key == "path") {
+            next_path = record.substr(equal + 1);
+          }
+          else if (key == "size") {
+            next_size = strtoull(record.c_str() + equal + 1, NULL, 10);
+            next_size_given = true;
+          }
+        }
+        position += length;
+      }
+    }
+    else if (wanted) {
+      path = normalize_tar_path(path);
+      if (extension == ".2sflib") {
+        failures += add_lib(path, data);
+      }
+      else {
+        failures += add_file(path, data);
+      }
+    }
+  }
+
+  // the files left have psflibs missing in the archive
+  for (const PSFProgram & program : pending_) {
+    std::vector<const PSFProgram *> programs;
+    std::string missing_lib;
+    resolve(program, programs, 0, missing_lib);
+    std::cout << "Error: " << program.filename << ": " << missing_lib << ": "
+      << "psflib not found in the archive." << std::endl;
+    failures++;
+  }
+  pending_.clear();
+  return failures;
+}
+
+/// Adds a psflib, and converts the files waiting for it.
+int TarConverter::add_lib(const std::string & path, const std::string & data) {
+  try {
+    PSFProgram program;
+    program.filename = path;
+    program.psf = PSFFile(data.data(), data.size(), path);
+    validate_program(program, path);
+    libs_[path] = std::move(program);
+  }
+  catch (const std::exception & ex) {
+    // reported when a file depends on it
+    lib_errors_[path] = ex.what();
+  }
+  return convert_pending();
+}
+
+/// Adds a 2SF file, and converts it if its psflibs are available.
+int TarConverter::add_file(const std::string & path, const std::string & data) {
+  try {
+    PSFProgram program;
+    program.filename = path;
+    program.psf = PSFFile(data.data(), data.size(), path);
+    validate_program(program, path);
+    pending_.push_back(std::move(program));
+  }
+  catch (const std::exception & ex) {
+    std::cout << "Error: " << ex.what() << std::endl;
+    return 1;
+  }
+  return convert_pending();
+}
+
+/// Resolves the programs of a file and its psflibs read so far.
+bool TarConverter::resolve(const PSFProgram & program, std::vector<const PSFProgram *> & programs, int lib_nest_level,
+    std::string & missing_lib) const {
+  const std::string & filename = program.filename;
+  if (lib_nest_level >= kPSFLibMaxNestLevel) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Nest level error on psflib loading.";
+    throw std::out_of_range(message_buffer.str());
+  }
+
+  // the lib path is relative to the directory of the file in the archive
+  size_t separator = filename.find_last_of('/');
+  std::string basedir = (separator != std::string::npos) ? filename.substr(0, separator + 1) : std::string();
+  int lib_index = 1;
+  while (true) {
+    char lib_tag_name[16];
+    if (lib_index > 1) {
+      snprintf(lib_tag_name, sizeof(lib_tag_name), "_lib%d", lib_index);
+    }
+    else {
+      strcpy(lib_tag_name, "_lib");
+    }
+
+    auto lib_tag = program.psf.tags().find(lib_tag_name);
+    if (lib_tag == program.psf.tags().end()) {
+      break;
+    }
+
+    std::string lib_path = normalize_tar_path(basedir + lib_tag->second);
+    auto lib_error = lib_errors_.find(lib_path);
+    if (lib_error != lib_errors_.end()) {
+      throw std::runtime_error(lib_error->second);
+    }
+    auto lib = libs_.find(lib_path);
+    if (lib == libs_.end()) {
+      missing_lib = lib_path;
+      return false;
+    }
+    if (!resolve(lib->second, programs, lib_nest_level + 1, missing_lib)) {
+      return false;
+    }
+
+    lib_index++;
+  }
+
+  // check the rom buffer size
+  uint64_t load_end = static_cast<uint64_t>(program.load_offset) + program.load_size;
+  if (!programs.empty() &&
+      load_end > static_cast<uint64_t>(programs.front()->load_offset) + programs.front()->load_size) {
+    std::ostringstream message_buffer;
+    message_buffer << filename << ": " << "Load offset/size of 2SF is out of bound.";
+    throw std::out_of_range(message_buffer.str());
+  }
+
+  programs.push_back(&program);
+  return true;
+}
+
+/// Converts the pending files whose psflibs are available.
+int TarConverter::convert_pending() {
+  int failures = 0;
+  for (auto it = pending_.begin(); it != pending_.end(); ) {
+    try {
+      std::vector<const PSFProgram *> programs;
+      std::string missing_lib;
+      if (!resolve(*it, programs, 0, missing_lib)) {
+        ++it;
+        continue;
+      }
+      convert(programs);
+    }
+    catch (const std::exception & ex) {
+      std::cout << "Error: " << ex.what() << std::endl;
+      failures++;
+    }
+    it = pending_.erase(it);
+  }
+  return failures;
+}
+
+/// Writes the ROM of a resolved file.
+void TarConverter::convert(const std::vector<const PSFProgram *> & programs) {
+  const PSFProgram & program = *programs.back();
+
+  // the paths of the archive are reproduced in the output directory
+  if (program.filename.compare(0, 3, "../") == 0) {
+    std::ostringstream message_buffer;
+    message_buffer << program.filename << ": " << "Path out of the archive.";
+    throw std::runtime_error(message_buffer.str());
+  }
+  std::string output_filename = program.filename;
+  output_filename = output_filename.substr(0, output_filename.find_last_of('.')) + ".data.bin";
+  if (output_mode_ == RomOutputMode::kChunkedGzip) {
+    output_filename += ".gz";
+  }
+  if (!output_directory_.empty()) {
+    output_filename = output_directory_ + PATH_SEPARATOR_STR + output_filename;
+  }
+  make_parent_directories(output_filename);
+
+  // the first loaded program determines the ROM size
+  std::vector<char> rom(static_cast<size_t>(programs.front()->load_offset) + programs.front()->load_size, 0);
+  for (size_t i = 0; i + 1 < programs.size(); i++) {
+    cache_.load(*programs[i], rom.data() + programs[i]->load_offset);
+  }
+  inflate_program(program, rom.data() + program.load_offset);
+  write_rom(output_filename, rom.data(), rom.size(), output_mode_);
+}
@@ -0,0 +1,98 @@
+/// @file
+/// TarConverter class header.
+
+#ifndef TAR_CONVERTER_HPP_
+#define TAR_CONVERTER_HPP_
+
+#include <istream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lib_cache.hpp"
+#include "psf_file.hpp"
+#include "rom_loader.hpp"
+#include "rom_writer.hpp"
+
+/// The size of a block of tar archives.
+constexpr size_t kTarBlockSize = 512;
+
+/// The TarConverter class converts the 2SF files in a tar stream to NDS ROM
+/// files, without extracting the archive.
+///
+/// The stream is read sequentially (ustar, with pax and GNU long names).
+/// psflibs are kept in memory keyed by their paths in the archive, and the
+/// _lib tags of each file are resolved against the members read so far.
+/// A file whose psflibs have not arrived yet is deferred until they do, so
+/// the members can appear in any order. psflibs are decompressed through a
+/// LibCache as in BatchConverter.
+class TarConverter {
+public:
+  /// Constructs a new TarConverter.
+  /// @param output_directory the directory receiving the ROM files, in which
+  /// the paths of the archive are reproduced.
+  /// @param output_mode the format of the output ROM files.
+  /// @param cache_capacity the maximum number of bytes held by the psflib
+  /// cache.
+  TarConverter(const std::string & output_directory, RomOutputMode output_mode,
+    size_t cache_capacity = kLibCacheDefaultCapacity);
+
+  /// Converts the 2SF files in a tar stream.
+  /// @param in the tar stream.
+  /// @param name the name of the stream for error messages.
+  /// @return the number of files failed to be converted.
+  ///
+  /// @remarks The errors are reported to the standard output.
+  int run(std::istream & in, const std::string & name);
+
+private:
+  /// Adds a psflib, and converts the files waiting for it.
+  /// @param path the path of the psflib in the archive.
+  /// @param data the content of the psflib.
+  /// @return the number of files failed to be converted.
+  int add_lib(const std::string & path, const std::string & data);
+
+  /// Adds a 2SF file, and converts it if its psflibs are available.
+  /// @param path the path of the file in the archive.
+  /// @param data the content of the file.
+  /// @return the number of files failed to be converted.
+  int add_file(const std::string & path, const std::string & data);
+
+  /// Resolves the programs of a file and its psflibs read so far.
+  /// @param program the program of the file.
+  /// @param programs the programs to be appended, in the order of loading.
+  /// @param lib_nest_level the nest level of psflib.
+  /// @param missing_lib the path of the psflib which has not arrived yet.
+  /// @return false if a psflib has not arrived yet.
+  bool resolve(const PSFProgram & program, std::vector<const PSFProgram *> & programs, int lib_nest_level,
+    std::string & missing_lib) const;
+
+  /// Converts the pending files whose psflibs are available.
+  /// @return the number of files failed to be converted.
+  int convert_pending();
+
+  /// Writes the ROM of a resolved file.
+  /// @param programs the programs in the order of loading.
+  void convert(const std::vector<const PSFProgram *> & programs);
+
+  /// The directory receiving the ROM files.
+  std::string output_directory_;
+
+  /// The format of the output ROM files.
+  RomOutputMode output_mode_;
+
+  /// The cache of decompressed psflibs.
+  LibCache cache_;
+
+  /// The psflibs keyed by their paths in the archive.
+  std::map<std::string, PSFProgram> libs_;
+
+  /// The errors of the psflibs failed to be read, keyed by their paths.
+  std::map<std::string, std::string> lib_errors_;
+
+  /// The files waiting for their psflibs.
+  std::vector<PSFProgram> pending_;
+};
+
+#endif // !TAR_CONVERTER_HPP_